@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+/* Multi-producer/single-consumer queue. Producers append under a short lock and the consumer takes everything that has piled up
+in one go by swapping vectors, so a big backlog costs the same as a small one and nobody holds the lock while handling messages. */
+template <typename T>
+class BlockingQueue {
+	private:
+		std::mutex mutex;
+		std::condition_variable not_empty;
+		std::vector<T> items;
+		bool is_closed = false;
+
+	public:
+		void push(T item) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				items.emplace_back(std::move(item));
+			}
+
+			not_empty.notify_one();
+		}
+
+		void push_batch(std::vector<T>& batch) { // Moves every element out of batch, leaving it empty.
+			if (batch.empty())
+				return;
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+
+				for (auto&& item : batch) {
+					items.emplace_back(std::move(item));
+				}
+			}
+
+			batch.clear();
+			not_empty.notify_one();
+		}
+
+		// Blocks until there is something to take, then swaps every queued item into out. Returns false once the queue is closed and empty.
+		bool wait_and_drain(std::vector<T>& out) {
+			out.clear();
+
+			std::unique_lock<std::mutex> lock(mutex);
+			not_empty.wait(lock, [this] { return !items.empty() || is_closed; });
+
+			if (items.empty())
+				return false;
+
+			items.swap(out);
+			return true;
+		}
+
+		void close() { // Wakes the consumer up so it can exit.
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				is_closed = true;
+			}
+
+			not_empty.notify_all();
+		}
+};
@@ -4,6 +4,8 @@ ChatWindow::ChatWindow(QWidget *parent)
 	: QWidget(parent)
 {
 	ui.setupUi(this);
+	ui.messages_list->setModel(&message_model);
+	search_delay_timer.setSingleShot(true);
 
 	try {
 		new_message_sfx.setSource(QUrl::fromLocalFile("sfx/new_message.wav"));
@@ -28,7 +30,11 @@ ChatWindow::ChatWindow(QWidget *parent)
 
 	connect(ui.friends_list, &QListWidget::itemActivated, this, &ChatWindow::friend_selected);
 	connect(ui.friend_requests_list, &QListWidget::itemActivated, this, &ChatWindow::friend_request_selected);
-	connect(ui.messages_list, &QListWidget::itemActivated, this, &ChatWindow::message_double_clicked);
+	connect(ui.messages_list, &QListView::activated, this, &ChatWindow::message_double_clicked);
+	connect(ui.messages_list->verticalScrollBar(), &QScrollBar::valueChanged, this, &ChatWindow::messages_scrolled);
+	connect(ui.search_box, &QLineEdit::textChanged, this, &ChatWindow::search_text_changed);
+	connect(&search_delay_timer, &QTimer::timeout, this, &ChatWindow::run_search);
+	connect(ui.search_results, &QListWidget::itemActivated, this, &ChatWindow::search_hit_selected);
 
 	ui.friends_list->setContextMenuPolicy(Qt::CustomContextMenu);
 	ui.friend_requests_list->setContextMenuPolicy(Qt::CustomContextMenu);
@@ -43,10 +49,12 @@ ChatWindow::~ChatWindow()
 {
 }	
 
-void ChatWindow::setup(std::vector<std::string> friends, std::vector<std::string> friend_requests) {
+void ChatWindow::setup(const std::vector<std::string>& friends, const std::vector<std::string>& friend_requests) {
+	message_cache.open(username);
+
 	// Set up friends list.
 	for (auto&& user : friends) {
-		ui.friends_list->addItem(QString::fromStdString(user));
+		add_friend_item(QString::fromStdString(user));
 	}
 
 	// Set up friend requests list.
@@ -79,20 +87,48 @@ void ChatWindow::message_send_confirmed_slot() {
 	else if (message_content.length() < 1)
 		return;
 	else {
-		emit message_sent(message_content, last_selected_friend);
+		emit message_sent(message_content, last_selected_friend); // Shown through add_sent_message once it is on its way.
+		ui.message_box->clear();
 
-		QString current_time = QString::fromStdString(Globals::time::current_time_as_readable_string());
-		QString msg_to_add_to_message_box = Globals::generate_message(current_time, username, message_content);
+	}
+}
 
-		QList<QVariant> friend_data = ui.friends_list->currentItem()->data(Qt::UserRole).toList();
-		friend_data.insert(friend_data.begin(), msg_to_add_to_message_box);
-		ui.friends_list->currentItem()->setData(Qt::UserRole, friend_data);
-		
-		ui.messages_list->addItem(msg_to_add_to_message_box);
-		ui.messages_list->scrollToBottom();
-		ui.message_box->clear();
+uint64_t ChatWindow::add_sent_message(const QString& friend_username, const QString& message_content) {
+	Conversation* conversation = conversations.find(friend_username);
 
+	if (conversation == nullptr) // The fetch will bring this message along.
+		return 0;
+
+	unsigned long long current_time = static_cast<unsigned long long>(std::time(nullptr));
+	uint64_t send_id = ++last_send_id;
+
+	conversation->add_pending(send_id, StoredMessage{ current_time, UsernameTable::instance().intern(username), message_content.toStdString() });
+
+	if (message_model.get_shown_friend() == friend_username) {
+		message_model.messages_appended();
+		ui.messages_list->scrollToBottom();
 	}
+
+	return send_id;
+}
+
+void ChatWindow::sent_message_confirmed(const QString& friend_username, uint64_t send_id) {
+	Conversation* conversation = conversations.find(friend_username);
+
+	if (conversation != nullptr) // Stays pending until a page fetched for other reasons brings the server's copy.
+		conversation->confirm_pending(send_id);
+}
+
+void ChatWindow::remove_sent_message(const QString& friend_username, uint64_t send_id) {
+	Conversation* conversation = conversations.find(friend_username);
+
+	if (conversation == nullptr)
+		return;
+
+	conversation->remove_pending(send_id);
+
+	if (message_model.get_shown_friend() == friend_username)
+		message_model.messages_appended();
 }
 
 void ChatWindow::logout_button_clicked() {
@@ -101,39 +137,105 @@ void ChatWindow::logout_button_clicked() {
 
 void ChatWindow::reset() {
 	ui.friends_list->clear();
+	friend_items.clear();
 	ui.friend_requests_list->clear();
-	ui.messages_list->clear();
+	message_model.clear();
+	conversations.clear();
+	history_requests_in_flight.clear();
+	message_cache.close();
+	ui.search_box->clear();
+	search_delay_timer.stop();
+	ui.search_results->clear();
+	enforce_memory_budget();
+}
+
+void ChatWindow::resync_after_reconnect(const std::vector<std::string>& friends, const std::vector<std::string>& friend_requests) {
+	QSet<QString> current_friends;
+
+	for (auto&& user : friends) {
+		QString friend_username = QString::fromStdString(user);
+
+		add_friend_item(friend_username);
+		current_friends.insert(friend_username);
+	}
+
+	for (auto&& friend_username : friend_items.keys()) { // Deleted us while we were offline.
+		if (!current_friends.contains(friend_username))
+			remove_from_friends_list(friend_username);
+	}
+
+	ui.friend_requests_list->clear();
+
+	for (auto&& user : friend_requests) {
+		ui.friend_requests_list->addItem(QString::fromStdString(user));
+	}
+
+	history_requests_in_flight.clear(); // Their responses went down with the old connection.
+
+	for (auto&& friend_username : conversations.get_loaded_friends()) {
+		request_history_page(friend_username, history_page_size);
+	}
+
+	enforce_memory_budget();
 }
 
 void ChatWindow::friend_selected(QListWidgetItem* item) {
 	last_selected_friend = item->text();
 
-	if (item->data(Qt::UserRole).isNull()) {
-		ui.messages_list->addItem("Fetching messages, please wait...");
-		emit messages_requested(last_selected_friend, 100); // Request the last 100 messages.
+	Conversation* conversation = conversations.find(last_selected_friend);
+
+	if (conversation != nullptr) {
+		update_chatbox(false);
+
+		if (conversation->has_confirmed_pending()) // Swaps the sent messages for the server's copies, which can be cached.
+			request_history_page(last_selected_friend, history_page_size);
+
+		return;
 	}
-	else {
+
+	size_t cached_message_count = message_cache.message_count(last_selected_friend);
+
+	if (cached_message_count > 0) { // Show what's cached right away, the newest page only brings in what was missed since.
+		size_t loaded_message_count = std::min<size_t>(cached_message_count, history_page_size);
+		std::vector<StoredMessage> cached_messages = message_cache.load(last_selected_friend, cached_message_count - loaded_message_count, loaded_message_count);
+
+		conversations.set_history(last_selected_friend, cached_messages);
 		update_chatbox(false);
 	}
+	else {
+		message_model.show_placeholder("Fetching messages, please wait...");
+	}
+
+	request_history_page(last_selected_friend, history_page_size); // Request the newest page.
+	enforce_memory_budget();
+}
+
+void ChatWindow::flush_message_cache() {
+	message_cache.flush();
 }
 
 void ChatWindow::update_chatbox(bool is_for_new_message) {
 	QListWidgetItem* current_item = ui.friends_list->currentItem();
 
-	if (current_item->data(Qt::UserRole).isNull())
+	if (current_item == nullptr)
+		return;
+
+	Conversation* conversation = conversations.find(current_item->text());
+
+	if (conversation == nullptr)
 		return;
 
 	if (current_item->foreground() == Qt::red) { // If we had a new message notification from this friend, change it back to normal.
 		current_item->setForeground(Qt::black);
 	}
 
-	ui.messages_list->clear();
-	QList<QVariant> message_data = current_item->data(Qt::UserRole).toList();
+	conversations.mark_viewed(current_item->text());
 
-	for (auto&& message_in_qlist : boost::adaptors::reverse(message_data)) { // Reverse the QList to add messages old-to-new.
-		QString message = message_in_qlist.toString();
-		ui.messages_list->addItem(message);
-	}
+	// The model only inserts the rows that are new, or swaps the whole conversation in without building any rows.
+	if (is_for_new_message && message_model.get_shown_friend() == current_item->text())
+		message_model.messages_appended();
+	else
+		message_model.show_conversation(current_item->text(), conversation);
 
 	ui.messages_list->scrollToBottom();
 }
@@ -149,7 +251,7 @@ void ChatWindow::friend_request_selected(QListWidgetItem* item) {
 		qDeleteAll(ui.friend_requests_list->findItems(item_text, Qt::MatchFixedString));
 
 		emit friendship_request_responded(true, item_text);
-		ui.friends_list->addItem(item_text);
+		add_friend_item(item_text);
 	}
 	else if (reply == QMessageBox::No) {
 		qDeleteAll(ui.friend_requests_list->findItems(item_text, Qt::MatchFixedString));
@@ -167,11 +269,26 @@ void ChatWindow::add_new_friend_request(QString sender) {
 }
 
 void ChatWindow::add_new_friend(QString username) {
-	ui.friends_list->addItem(username);
+	add_friend_item(username);
+}
+
+void ChatWindow::add_friend_item(QString username) {
+	if (friend_items.contains(username))
+		return;
+
+	QListWidgetItem* item = new QListWidgetItem(username, ui.friends_list);
+	friend_items.insert(username, item);
 }
 
 void ChatWindow::remove_from_friends_list(QString username) {
-	qDeleteAll(ui.friends_list->findItems(username, Qt::MatchFixedString));
+	delete friend_items.take(username); // Deleting the item also removes it from the list widget. Deleting nullptr is a no-op.
+
+	if (message_model.get_shown_friend() == username)
+		message_model.clear();
+
+	conversations.remove(username);
+	history_requests_in_flight.remove(username);
+	message_cache.remove(username);
 }
 
 void ChatWindow::display_context_menu_on_friends_list() {
@@ -202,7 +319,7 @@ void ChatWindow::display_context_menu_on_friend_requests_list() {
 
 	connect(&accept_friend_request_action, &QAction::triggered, [=] {qDeleteAll(ui.friend_requests_list->findItems(current_user, Qt::MatchFixedString));
 																	 emit friendship_request_responded(true, current_user);
-																	 ui.friends_list->addItem(current_user); });
+																	 add_friend_item(current_user); });
 	connect(&reject_friend_request_action, &QAction::triggered, [=] {qDeleteAll(ui.friend_requests_list->findItems(current_user, Qt::MatchFixedString));
 																	 emit friendship_request_responded(false, current_user); });
 
@@ -212,15 +329,127 @@ void ChatWindow::display_context_menu_on_friend_requests_list() {
 	context_menu.exec(QCursor::pos());
 }
 
-void ChatWindow::set_friend_data(QString friend_username, QVariant data) {
-	QList<QListWidgetItem*> items = ui.friends_list->findItems(friend_username, Qt::MatchExactly);
+void ChatWindow::add_history_page(QString friend_username, int max_index, std::vector<StoredMessage>& oldest_first_messages) {
+	history_requests_in_flight.remove(friend_username);
+
+	if (!friend_items.contains(friend_username)) {
+		std::cerr << "Something went wrong with ChatWindow::add_history_page." << "\n";
+		return;
+	}
+
+	bool is_last_page = static_cast<int>(oldest_first_messages.size()) < history_page_size;
+	bool is_shown = message_model.get_shown_friend() == friend_username;
+	Conversation* conversation = conversations.find(friend_username);
+
+	if (max_index > history_page_size) {
+		if (conversation == nullptr) // Evicted or removed while the page was on its way.
+			return;
 
-	if (items.size() > 0) {
-		items[0]->setData(Qt::UserRole, data);
+		prepend_older_messages(friend_username, *conversation, oldest_first_messages); // Older pages aren't cached, the log only grows at its end.
 	}
 	else {
-		std::cerr << "Something went wrong with ChatWindow::set_friend_data." << "\n";
+		std::vector<StoredMessage> new_messages;
+
+		if (conversation != nullptr && conversation->merge_newest(oldest_first_messages, new_messages)) { // Synced what's cached with the server.
+			message_cache.append(friend_username, new_messages);
+
+			if (is_shown)
+				message_model.messages_appended();
+		}
+		else { // Nothing was loaded, or the cached messages are too old to connect to the newest page.
+			message_cache.replace(friend_username, oldest_first_messages);
+			conversation = &conversations.set_history(friend_username, oldest_first_messages);
+
+			if (is_shown) // The shown rows now point at messages that were replaced.
+				message_model.show_conversation(friend_username, conversation);
+		}
 	}
+
+	if (is_last_page)
+		conversation->mark_complete();
+
+	if (is_shown)
+		prefetch_older_messages_if_needed();
+
+	enforce_memory_budget();
+}
+
+void ChatWindow::history_page_failed(QString friend_username) {
+	history_requests_in_flight.remove(friend_username);
+}
+
+bool ChatWindow::append_message(const QString& friend_username, StoredMessage message) {
+	Conversation* conversation = conversations.find(friend_username);
+
+	if (conversation == nullptr)
+		return false;
+
+	message_cache.append(friend_username, message);
+	conversation->append(std::move(message));
+	enforce_memory_budget();
+	return true;
+}
+
+void ChatWindow::request_history_page(const QString& friend_username, int max_index) {
+	if (history_requests_in_flight.contains(friend_username)) // Already on its way, or another page of it is.
+		return;
+
+	history_requests_in_flight.insert(friend_username, max_index);
+	emit messages_requested(friend_username, max_index);
+}
+
+void ChatWindow::request_older_messages(const QString& friend_username) {
+	Conversation* conversation = conversations.find(friend_username);
+
+	if (conversation == nullptr || conversation->is_complete())
+		return;
+
+	// Conversations are loaded from the end of the cache, so as long as they are shorter than it, the cache has the older messages.
+	size_t stored_message_count = conversation->server_message_count(); // Pending messages are neither cached nor counted by the server.
+	size_t cached_message_count = message_cache.message_count(friend_username);
+
+	if (stored_message_count < cached_message_count) {
+		size_t loaded_message_count = std::min<size_t>(cached_message_count - stored_message_count, history_page_size);
+		std::vector<StoredMessage> cached_messages = message_cache.load(friend_username, cached_message_count - stored_message_count - loaded_message_count, loaded_message_count);
+
+		prepend_older_messages(friend_username, *conversation, cached_messages);
+		return;
+	}
+
+	// Pages are counted back from the newest message, so the next one ends right past what's already stored.
+	request_history_page(friend_username, static_cast<int>(stored_message_count) + history_page_size);
+}
+
+void ChatWindow::prepend_older_messages(const QString& friend_username, Conversation& conversation, std::vector<StoredMessage>& oldest_first_messages) {
+	int prepended_count = static_cast<int>(conversation.prepend_older(oldest_first_messages));
+
+	if (message_model.get_shown_friend() == friend_username && prepended_count > 0) {
+		// Keep the message at the top of the view where it is, instead of jumping to the older messages.
+		QModelIndex top_index = ui.messages_list->indexAt(QPoint(0, 0));
+		int top_row = top_index.isValid() ? top_index.row() : 0;
+
+		message_model.messages_prepended(prepended_count);
+		ui.messages_list->scrollTo(message_model.index(top_row + prepended_count), QAbstractItemView::PositionAtTop);
+	}
+
+	enforce_memory_budget();
+}
+
+void ChatWindow::prefetch_older_messages_if_needed() {
+	QString shown_friend = message_model.get_shown_friend();
+
+	if (shown_friend.isEmpty())
+		return;
+
+	QScrollBar* scroll_bar = ui.messages_list->verticalScrollBar();
+
+	// Conversations that don't fill the view have nothing to scroll, they are fetched until they do or until there is nothing older.
+	if (scroll_bar->value() <= scroll_bar->pageStep() * history_prefetch_pages)
+		request_older_messages(shown_friend);
+}
+
+void ChatWindow::messages_scrolled(int) {
+	prefetch_older_messages_if_needed();
 }
 
 QListWidget* ChatWindow::get_friends_list_object() {
@@ -237,19 +466,19 @@ void ChatWindow::keyPressEvent(QKeyEvent* event) {
 }
 
 void ChatWindow::update_friend_icon(QString friend_username, bool is_online) {
-	QList<QListWidgetItem*> items = ui.friends_list->findItems(friend_username, Qt::MatchExactly);
+	QListWidgetItem* item = friend_items.value(friend_username, nullptr);
 
-	if (items.size() > 0) {
-		is_online ? items[0]->setIcon(online_icon) : items[0]->setIcon(offline_icon);
+	if (item != nullptr) {
+		is_online ? item->setIcon(online_icon) : item->setIcon(offline_icon);
 	}
 }
 
 void ChatWindow::change_friend_colour(QString username, QBrush qtcolour) { // TODO - this function crashes when there is no friends selected, find out why
 	try {
-		QList<QListWidgetItem*> items = ui.friends_list->findItems(username, Qt::MatchExactly);
+		QListWidgetItem* item = friend_items.value(username, nullptr);
 
-		if (items.size() > 0) {
-			items[0]->setForeground(qtcolour);
+		if (item != nullptr) {
+			item->setForeground(qtcolour);
 		}
 	}
 	catch (const std::exception & e) {
@@ -261,15 +490,136 @@ void ChatWindow::change_friend_colour(QString username, QBrush qtcolour) { // TO
 }
 
 QListWidgetItem* ChatWindow::get_friend_qlistwidgetitem_object_by_name(QString friend_username) {
-	QList<QListWidgetItem*> items = ui.friends_list->findItems(friend_username, Qt::MatchExactly);
-
-	if (items.size() > 0)
-		return items[0];
-	else
-		return nullptr;
+	return friend_items.value(friend_username, nullptr);
 }
 
-void ChatWindow::message_double_clicked(QListWidgetItem* item) {
+void ChatWindow::message_double_clicked(const QModelIndex& index) {
 	QClipboard* clipboard = QApplication::clipboard();
-	clipboard->setText(item->text());
-}
\ No newline at end of file
+	clipboard->setText(index.data().toString());
+}
+
+void ChatWindow::search_text_changed(const QString&) {
+	search_delay_timer.start(search_delay_in_milliseconds);
+}
+
+void ChatWindow::run_search() {
+	ui.search_results->clear();
+
+	std::vector<SearchHit> hits = message_cache.search(ui.search_box->text(), max_search_hit_count);
+
+	// Hits are read per conversation, so each log is mapped once no matter how many of them it has.
+	QHash<QString, std::vector<size_t>> hits_by_friend; // Positions in hits.
+
+	for (size_t i = 0; i < hits.size(); i++) {
+		hits_by_friend[hits[i].friend_username].push_back(i);
+	}
+
+	std::vector<StoredMessage> hit_messages(hits.size());
+	std::vector<char> is_loaded(hits.size(), false);
+
+	for (auto it = hits_by_friend.constBegin(); it != hits_by_friend.constEnd(); ++it) {
+		size_t cached_message_count = message_cache.message_count(it.key());
+		std::vector<size_t> hit_positions;
+		std::vector<size_t> message_indices;
+
+		for (size_t hit_position : it.value()) {
+			if (hits[hit_position].message_index < cached_message_count) { // load_each skips the rest, which would misalign the two.
+				hit_positions.push_back(hit_position);
+				message_indices.push_back(hits[hit_position].message_index);
+			}
+		}
+
+		std::vector<StoredMessage> messages = message_cache.load_each(it.key(), message_indices);
+
+		for (size_t i = 0; i < messages.size(); i++) {
+			hit_messages[hit_positions[i]] = std::move(messages[i]);
+			is_loaded[hit_positions[i]] = true;
+		}
+	}
+
+	for (size_t i = 0; i < hits.size(); i++) {
+		if (!is_loaded[i])
+			continue;
+
+		const StoredMessage& message = hit_messages[i];
+		QString sent_at = QString::fromStdString(Globals::time::unix_time_to_readable_string(message.sent_at));
+		QString sent_by = UsernameTable::instance().name(message.sent_by);
+		QString content = QString::fromUtf8(message.content.data(), static_cast<int>(message.content.size()));
+		QListWidgetItem* item = new QListWidgetItem(hits[i].friend_username + " - " + Globals::generate_message(sent_at, sent_by, content), ui.search_results);
+
+		item->setData(Qt::UserRole, hits[i].friend_username);
+		item->setData(Qt::UserRole + 1, static_cast<qulonglong>(hits[i].message_index));
+	}
+}
+
+void ChatWindow::search_hit_selected(QListWidgetItem* item) {
+	QString friend_username = item->data(Qt::UserRole).toString();
+	QListWidgetItem* friend_item = friend_items.value(friend_username, nullptr);
+
+	if (friend_item == nullptr)
+		return;
+
+	ui.friends_list->setCurrentItem(friend_item);
+	friend_selected(friend_item);
+	show_cached_message(friend_username, static_cast<size_t>(item->data(Qt::UserRole + 1).toULongLong()));
+}
+
+void ChatWindow::show_cached_message(const QString& friend_username, size_t message_index) {
+	Conversation* conversation = conversations.find(friend_username);
+	size_t cached_message_count = message_cache.message_count(friend_username);
+
+	if (conversation == nullptr || message_index >= cached_message_count)
+		return;
+
+	// The server's messages end with the cached ones, so the message is this many rows above the first pending one.
+	size_t distance_from_end = cached_message_count - message_index;
+
+	while (conversation->server_message_count() < distance_from_end && conversation->server_message_count() < cached_message_count) {
+		size_t stored_message_count = conversation->server_message_count();
+		request_older_messages(friend_username); // Always reads from the cache here, it has messages older than the loaded ones.
+
+		if (conversation->server_message_count() == stored_message_count)
+			break;
+	}
+
+	if (conversation->server_message_count() >= distance_from_end && message_model.get_shown_friend() == friend_username) {
+		QModelIndex index = message_model.index(static_cast<int>(conversation->server_message_count() - distance_from_end));
+
+		ui.messages_list->scrollTo(index, QAbstractItemView::PositionAtCenter);
+		ui.messages_list->setCurrentIndex(index);
+	}
+}
+
+void ChatWindow::set_memory_budget(size_t memory_budget_in_bytes) {
+	memory_budget = memory_budget_in_bytes;
+	enforce_memory_budget();
+}
+
+void ChatWindow::update_connection_quality(int rtt_in_milliseconds) {
+	QString quality = "poor";
+
+	if (rtt_in_milliseconds < 100)
+		quality = "good";
+	else if (rtt_in_milliseconds < 300)
+		quality = "fair";
+
+	ui.connection_quality_label->setText(QString("Connection: %1 (%2 ms)").arg(quality).arg(rtt_in_milliseconds));
+}
+
+void ChatWindow::show_connection_status(const QString& status) {
+	ui.connection_quality_label->setText("Connection: " + status);
+}
+
+void ChatWindow::enforce_memory_budget() {
+	QString shown_friend = message_model.get_shown_friend();
+
+	// The shown conversation stays, and so do the ones with a page on its way, which is merged into them when it arrives.
+	conversations.evict_to_budget(memory_budget, [&](const QString& friend_username) {
+		return friend_username != shown_friend && !history_requests_in_flight.contains(friend_username);
+	});
+
+	ui.memory_usage_label->setText(QString("History in memory: %1 / %2 MB (%3 conversations)")
+		.arg(conversations.get_memory_usage() / (1024.0 * 1024.0), 0, 'f', 1)
+		.arg(memory_budget / (1024 * 1024))
+		.arg(conversations.get_conversation_count()));
+}
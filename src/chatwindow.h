@@ -6,16 +6,24 @@
 #include <QDir>
 #include <QMenu>
 #include <QList>
+#include <QHash>
+#include <QSet>
 #include <QVariant>
 #include <QtMultimedia/QSoundEffect>
 #include <QUrl>
 #include <QIcon>
 #include <QBrush>
 #include <QClipboard>
+#include <QScrollBar>
+#include <QTimer>
 #include <vector>
+#include <algorithm>
 #include <iostream> // todo - temp
-#include <boost/range/adaptor/reversed.hpp>
 #include "globals.h"
+#include "conversationstore.h"
+#include "messagecache.h"
+#include "usernametable.h"
+#include "messagelistmodel.h"
 #include "customqtextedit.h"
 #include "ui_chatwindow.h"
 
@@ -24,25 +32,42 @@ class ChatWindow : public QWidget
 	Q_OBJECT
 
 public:
+	static constexpr int history_page_size = 100; // The server never returns more messages than this per request, a max_index up to it asks for the newest page.
+
 	ChatWindow(QWidget *parent = Q_NULLPTR);
 	~ChatWindow();
 	virtual void keyPressEvent(QKeyEvent* event);
-	void setup(std::vector<std::string> friends, std::vector<std::string> friend_requests);
+	void setup(const std::vector<std::string>& friends, const std::vector<std::string>& friend_requests);
 	void reset();
+	// Brings the lists in line with a login made after reconnecting and fetches the newest page of every loaded conversation, which merges in what was missed.
+	void resync_after_reconnect(const std::vector<std::string>& friends, const std::vector<std::string>& friend_requests);
 	void add_new_friend_request(QString sender);
 	void add_new_friend(QString username);
 	void remove_from_friends_list(QString username);
 	void update_chatbox(bool is_for_new_message);
+	void flush_message_cache(); // Writes out the messages cached since the last call. Called once per UI flush.
 	QListWidgetItem* get_currently_selected_friend();
 	QListWidget* get_friends_list_object();
-	void set_friend_data(QString friend_username, QVariant data);
+	// Stores a page of history that was requested with the given max_index. Moves the messages into the conversation store.
+	void add_history_page(QString friend_username, int max_index, std::vector<StoredMessage>& oldest_first_messages);
+	void history_page_failed(QString friend_username); // The request is forgotten, so the page can be requested again.
+	bool append_message(const QString& friend_username, StoredMessage message); // Stores and caches the message. Returns false (and drops it) if the history isn't loaded.
+	// Shows a message that made it into the outbound queue as pending, it is cached once a page brings the server's copy. Returns 0 if the history isn't loaded.
+	uint64_t add_sent_message(const QString& friend_username, const QString& message_content);
+	void sent_message_confirmed(const QString& friend_username, uint64_t send_id);
+	void remove_sent_message(const QString& friend_username, uint64_t send_id); // The server rejected it, or its result was lost with the connection.
 	void update_friend_icon(QString friend_username, bool is_online);
 	void change_friend_colour(QString friend_username, QBrush qtcolour);
 	QListWidgetItem* get_friend_qlistwidgetitem_object_by_name(QString friend_username);
+	void set_memory_budget(size_t memory_budget_in_bytes);
+	void update_connection_quality(int rtt_in_milliseconds);
+	void show_connection_status(const QString& status); // Replaces the quality readout until the next round trip time comes in.
 
 	QString username;
 	QString last_selected_friend;
 
+	ConversationStore conversations;
+
 	QSoundEffect new_message_sfx;
 	QSoundEffect new_friend_request_sfx;
 	QSoundEffect friend_deleted_sfx;
@@ -76,8 +101,33 @@ public slots:
 	void display_context_menu_on_friend_requests_list();
 
 	void friend_removal_requested_slot();
-	void message_double_clicked(QListWidgetItem* item);
+	void message_double_clicked(const QModelIndex& index);
+	void messages_scrolled(int scroll_position);
+	void search_text_changed(const QString& text); // Restarts search_delay_timer, the search runs once typing pauses.
+	void run_search();
+	void search_hit_selected(QListWidgetItem* item);
 
 private:
 	Ui::ChatWindow ui;
+	MessageListModel message_model;
+	MessageCache message_cache; // Open while logged in.
+
+	// Every item in ui.friends_list by username. Friend items must only be added and removed through add_friend_item and remove_from_friends_list to keep this in sync.
+	QHash<QString, QListWidgetItem*> friend_items;
+
+	static constexpr int history_prefetch_pages = 2; // Older messages are requested once the view is this many screens away from the top.
+	static constexpr int max_search_hit_count = 50;
+	static constexpr int search_delay_in_milliseconds = 250;
+	QTimer search_delay_timer;
+	QHash<QString, int> history_requests_in_flight; // max_index of the page being fetched for each friend, one at a time.
+	uint64_t last_send_id = 0;
+	size_t memory_budget = 32 * 1024 * 1024; // For the conversations in memory, the cache and the server have the rest.
+
+	void add_friend_item(QString username);
+	void request_history_page(const QString& friend_username, int max_index);
+	void request_older_messages(const QString& friend_username); // Reads them from the cache if it has them, otherwise asks the server.
+	void prepend_older_messages(const QString& friend_username, Conversation& conversation, std::vector<StoredMessage>& oldest_first_messages);
+	void prefetch_older_messages_if_needed();
+	void show_cached_message(const QString& friend_username, size_t message_index); // Loads older messages from the cache until it is in view.
+	void enforce_memory_budget(); // Drops the least recently viewed conversations that don't fit, and updates the memory usage readout.
 };
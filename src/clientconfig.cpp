@@ -0,0 +1,83 @@
+#include "clientconfig.h"
+
+ClientConfig ClientConfig::load(const std::string& path) {
+	using json = nlohmann::json;
+
+	ClientConfig config;
+
+	try {
+		std::ifstream ifs(path);
+		json config_file = json::parse(ifs);
+
+		if (config_file.contains("connection_info")) {
+			for (auto&& connection_info : config_file["connection_info"]) {
+				config.server_endpoints.emplace_back(connection_info.at("server_address").get<std::string>(), connection_info.at("server_port").get<std::string>());
+			}
+		}
+
+		if (config_file.contains("presence")) {
+			const json& presence = config_file["presence"];
+
+			config.presence_resync_interval_seconds = presence.value("resync_interval_seconds", config.presence_resync_interval_seconds);
+			config.presence_resync_batch_size = presence.value("resync_batch_size", config.presence_resync_batch_size);
+		}
+
+		if (config_file.contains("conversations")) {
+			const json& conversations = config_file["conversations"];
+
+			config.conversation_memory_budget_mb = conversations.value("memory_budget_mb", config.conversation_memory_budget_mb);
+		}
+
+		if (config_file.contains("reconnect")) {
+			const json& reconnect = config_file["reconnect"];
+
+			config.reconnect_initial_delay_ms = reconnect.value("initial_delay_ms", config.reconnect_initial_delay_ms);
+			config.reconnect_max_delay_ms = reconnect.value("max_delay_ms", config.reconnect_max_delay_ms);
+			config.reconnect_max_attempts = reconnect.value("max_attempts", config.reconnect_max_attempts);
+		}
+
+		if (config_file.contains("tls")) {
+			const json& tls = config_file["tls"];
+
+			config.tls_session_file = tls.value("session_file", config.tls_session_file);
+		}
+
+		if (config_file.contains("network")) {
+			const json& network = config_file["network"];
+
+			config.tcp_nodelay = network.value("tcp_nodelay", config.tcp_nodelay);
+			config.tcp_keepalive = network.value("tcp_keepalive", config.tcp_keepalive);
+			config.heartbeat_interval_seconds = network.value("heartbeat_interval_seconds", config.heartbeat_interval_seconds);
+			config.dead_link_timeout_seconds = network.value("dead_link_timeout_seconds", config.dead_link_timeout_seconds);
+		}
+	}
+	catch (const nlohmann::json::exception& e) {
+		std::cerr << "Error while reading optional settings from " << path << ", using the defaults: " << e.what() << "\n";
+	}
+
+	if (config.presence_resync_interval_seconds < 10)
+		config.presence_resync_interval_seconds = 10;
+
+	if (config.presence_resync_batch_size == 0)
+		config.presence_resync_batch_size = 1;
+
+	if (config.conversation_memory_budget_mb == 0)
+		config.conversation_memory_budget_mb = 1;
+
+	if (config.reconnect_initial_delay_ms < 100)
+		config.reconnect_initial_delay_ms = 100;
+
+	if (config.reconnect_max_delay_ms < config.reconnect_initial_delay_ms)
+		config.reconnect_max_delay_ms = config.reconnect_initial_delay_ms;
+
+	if (config.reconnect_max_attempts < 0)
+		config.reconnect_max_attempts = 0;
+
+	if (config.heartbeat_interval_seconds < 1)
+		config.heartbeat_interval_seconds = 1;
+
+	if (config.dead_link_timeout_seconds < 1)
+		config.dead_link_timeout_seconds = 1;
+
+	return config;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <utility>
+#include <nlohmann/json.hpp>
+
+// Client settings from client_config.json. Only "connection_info" is required, every other setting has a default.
+struct ClientConfig {
+	std::vector<std::pair<std::string, std::string>> server_endpoints; // Address and port of every connection_info entry. Empty if there are none.
+	int presence_resync_interval_seconds = 300; // How often the whole friend list's statuses are fetched again.
+	size_t presence_resync_batch_size = 100; // Maximum number of friends in a single get-statuses request.
+	size_t conversation_memory_budget_mb = 32; // Conversations that weren't viewed recently are dropped from memory past this.
+	int reconnect_initial_delay_ms = 500; // Delay before the first reconnect attempt, doubled for every attempt after it.
+	int reconnect_max_delay_ms = 30000;
+	int reconnect_max_attempts = 20; // The client gives up and exits after this many failed attempts in a row, 0 never gives up.
+	std::string tls_session_file = ""; // Where the TLS sessions are kept between runs for a faster first handshake, empty keeps them in memory only.
+	bool tcp_nodelay = true;
+	bool tcp_keepalive = true; // Uses the OS's keepalive timing, the heartbeat below notices a dead link much sooner.
+	int heartbeat_interval_seconds = 15;
+	int dead_link_timeout_seconds = 10; // How long a heartbeat may go unanswered before the connection is treated as lost.
+
+	static ClientConfig load(const std::string& path = "client_config.json"); // Never throws, falls back to the defaults and no servers.
+};
@@ -1,10 +1,160 @@
 #include "connectionmanager.h"
 
-ConnectionManager::ConnectionManager() : ssl_context(boost::asio::ssl::context::tls), socket(io_context, ssl_context) {
+ConnectionManager::ConnectionManager() : strand(boost::asio::make_strand(io_context)), work_guard(boost::asio::make_work_guard(io_context)),
+										 ssl_context(boost::asio::ssl::context::tls), shutdown_timer(strand), reconnect_timer(strand), attempt_delay_timer(strand),
+										 heartbeat_timer(strand), dead_link_timer(strand) {
 	ssl_context.set_verify_mode(boost::asio::ssl::verify_peer);
 }
 
-void ConnectionManager::connect() {
+ConnectionManager::~ConnectionManager() {
+	shutdown();
+}
+
+void ConnectionManager::set_frames_received_handler(std::function<void(std::vector<std::string>& frames)> handler) {
+	frames_received_handler = std::move(handler);
+}
+
+void ConnectionManager::set_connection_lost_handler(std::function<void()> handler) {
+	connection_lost_handler = std::move(handler);
+}
+
+void ConnectionManager::set_connected_handler(std::function<void()> handler) {
+	connected_handler = std::move(handler);
+}
+
+void ConnectionManager::set_disconnection_handler(std::function<void()> handler) {
+	disconnection_handler = std::move(handler);
+}
+
+void ConnectionManager::set_endpoints(const std::vector<std::pair<std::string, std::string>>& addresses_and_ports) {
+	server_endpoints.clear();
+
+	for (auto&& [address, port] : addresses_and_ports) {
+		server_endpoints.push_back(ServerEndpoint{ address, port });
+	}
+}
+
+void ConnectionManager::set_reconnect_policy(std::chrono::milliseconds initial_delay, std::chrono::milliseconds max_delay, int max_attempts) {
+	reconnect_initial_delay = initial_delay;
+	reconnect_max_delay = std::max(initial_delay, max_delay);
+	max_reconnect_attempts = max_attempts;
+}
+
+void ConnectionManager::set_tls_session_file(std::string path) {
+	tls_session_file = std::move(path);
+}
+
+void ConnectionManager::set_socket_options(bool tcp_nodelay, bool tcp_keepalive) {
+	is_tcp_nodelay_enabled = tcp_nodelay;
+	is_tcp_keepalive_enabled = tcp_keepalive;
+}
+
+void ConnectionManager::set_heartbeat(std::function<SendResult()> send_probe, std::chrono::seconds interval, std::chrono::seconds timeout) {
+	send_heartbeat_probe_request = std::move(send_probe);
+	heartbeat_interval = interval;
+	dead_link_timeout = timeout;
+}
+
+void ConnectionManager::set_rtt_handler(std::function<void(int rtt_in_milliseconds)> handler) {
+	rtt_handler = std::move(handler);
+}
+
+void ConnectionManager::set_heartbeat_active(bool is_active) {
+	boost::asio::post(strand, [this, is_active] {
+		is_heartbeat_active = is_active && send_heartbeat_probe_request && has_connected;
+		is_probe_outstanding = false;
+		heartbeat_timer.cancel();
+		dead_link_timer.cancel();
+
+		if (is_heartbeat_active)
+			send_heartbeat_probe(); // Measures the round trip time right away instead of an interval later.
+	});
+}
+
+void ConnectionManager::schedule_heartbeat() {
+	heartbeat_timer.expires_after(heartbeat_interval);
+	heartbeat_timer.async_wait([this, generation = connection_generation](const boost::system::error_code& timer_error) {
+		if (!timer_error && generation == connection_generation && is_heartbeat_active)
+			send_heartbeat_probe();
+	});
+}
+
+void ConnectionManager::send_heartbeat_probe() {
+	schedule_heartbeat();
+
+	if (is_probe_outstanding) // The dead link timer of the previous one is still running.
+		return;
+
+	bool is_queue_empty = queued_message_count == 0;
+
+	if (send_heartbeat_probe_request() != SendResult::QUEUED)
+		return; // The queue is full, so the link is busy and the next interval will try again.
+
+	is_probe_outstanding = true;
+	is_probe_alone = is_queue_empty;
+	probe_sent_at = std::chrono::steady_clock::now();
+	wait_for_sign_of_life();
+}
+
+void ConnectionManager::wait_for_sign_of_life() {
+	dead_link_timer.expires_at(std::max(probe_sent_at, bytes_received_at) + dead_link_timeout);
+	dead_link_timer.async_wait([this, generation = connection_generation](const boost::system::error_code& timer_error) {
+		if (timer_error || generation != connection_generation || !is_probe_outstanding)
+			return;
+
+		if (std::chrono::steady_clock::now() < std::max(probe_sent_at, bytes_received_at) + dead_link_timeout) { // Something arrived in the meantime.
+			wait_for_sign_of_life();
+			return;
+		}
+
+		std::cerr << "Nothing arrived within " << dead_link_timeout.count() << " seconds of a heartbeat." << "\n";
+		handle_io_error(boost::asio::error::timed_out, "heartbeat");
+	});
+}
+
+void ConnectionManager::heartbeat_answered() {
+	if (!is_probe_outstanding)
+		return;
+
+	is_probe_outstanding = false;
+	dead_link_timer.cancel();
+
+	if (!is_probe_alone)
+		return;
+
+	auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - probe_sent_at);
+	double rtt_ms = rtt.count() / 1000.0;
+
+	// Smoothed like TCP's SRTT, so one slow answer doesn't swing the reconnect timing or the quality readout.
+	smoothed_rtt_ms = smoothed_rtt_ms == 0 ? rtt_ms : smoothed_rtt_ms * 0.875 + rtt_ms * 0.125;
+
+	if (rtt_handler)
+		rtt_handler(static_cast<int>(smoothed_rtt_ms + 0.5));
+}
+
+std::chrono::milliseconds ConnectionManager::connection_attempt_delay() const {
+	if (smoothed_rtt_ms == 0)
+		return default_connection_attempt_delay;
+
+	return std::chrono::milliseconds(std::clamp(static_cast<long long>(smoothed_rtt_ms * 2), 100LL, 2000LL));
+}
+
+void ConnectionManager::apply_socket_options(SslStream& new_socket) {
+	boost::system::error_code option_error;
+
+	new_socket.lowest_layer().set_option(boost::asio::ip::tcp::no_delay(is_tcp_nodelay_enabled), option_error);
+
+	if (!option_error)
+		new_socket.lowest_layer().set_option(boost::asio::socket_base::keep_alive(is_tcp_keepalive_enabled), option_error);
+
+	if (option_error)
+		std::cerr << "Could not set the socket options: " << option_error.message() << "\n";
+}
+
+void ConnectionManager::configure_ssl_context() {
+	if (is_ssl_context_configured)
+		return;
+
 	try {
 		/* Explicitly tell the client to trust server.crt as that is a self-signed certificate - we normally
 		wouldn't need that while connecting to a server with a trusted certificate.
@@ -17,95 +167,623 @@ void ConnectionManager::connect() {
 		throw std::exception("Could not load the certificate file.");
 	}
 
+	// Sessions aren't looked up by OpenSSL on the client side, on_new_tls_session keeps the newest one per endpoint and make_socket offers it.
+	SSL_CTX* native_context = ssl_context.native_handle();
+	SSL_CTX_set_app_data(native_context, this);
+	SSL_CTX_set_session_cache_mode(native_context, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(native_context, &ConnectionManager::on_new_tls_session);
+
+	load_tls_sessions();
+	is_ssl_context_configured = true;
+}
+
+std::unique_ptr<SslStream> ConnectionManager::make_socket(const ServerEndpoint& endpoint) {
+	auto new_socket = std::make_unique<SslStream>(strand, ssl_context);
+	std::lock_guard<std::mutex> lock(tls_session_mutex);
+	auto& [endpoint_key, tls_session] = *tls_sessions.try_emplace(endpoint.key(), nullptr, &SSL_SESSION_free).first;
+
+	SSL_set_ex_data(new_socket->native_handle(), tls_endpoint_index(), const_cast<std::string*>(&endpoint_key));
+
+	if (tls_session != nullptr && SSL_set_session(new_socket->native_handle(), tls_session.get()) != 1)
+		std::cerr << "Could not offer the cached TLS session of " << endpoint_key << ", doing a full handshake." << "\n";
+
+	return new_socket;
+}
+
+int ConnectionManager::tls_endpoint_index() {
+	static int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+	return index;
+}
+
+int ConnectionManager::on_new_tls_session(SSL* ssl, SSL_SESSION* session) {
+	auto* connection_manager = static_cast<ConnectionManager*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+	auto* endpoint_key = static_cast<const std::string*>(SSL_get_ex_data(ssl, tls_endpoint_index()));
+
+	if (endpoint_key == nullptr)
+		return 0; // Not one of our sockets, OpenSSL keeps its reference.
+
+	std::lock_guard<std::mutex> lock(connection_manager->tls_session_mutex);
+	connection_manager->tls_sessions.at(*endpoint_key).reset(session);
+	connection_manager->has_new_tls_session = true; // Saved at shutdown, not on the I/O thread for every ticket.
+
+	return 1; // We keep the reference OpenSSL passed in.
+}
+
+void ConnectionManager::load_tls_sessions() {
+	if (tls_session_file.empty())
+		return;
+
+	std::ifstream ifs(tls_session_file, std::ios::binary);
+
+	if (!ifs)
+		return; // Nothing saved yet.
+
 	try {
-		using json = nlohmann::json;
+		nlohmann::json saved_sessions = nlohmann::json::parse(ifs);
+		std::lock_guard<std::mutex> lock(tls_session_mutex);
 
-		std::ifstream ifs("client_config.json");
-		json config_file = json::parse(ifs);
+		for (auto&& [endpoint_key, hex_session] : saved_sessions.items()) {
+			if (!hex_session.is_string())
+				continue;
+
+			const std::string& hex = hex_session.get_ref<const std::string&>();
+			std::string bytes;
+
+			for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+				bytes.push_back(static_cast<char>(std::stoi(hex.substr(i, 2), nullptr, 16)));
+			}
+
+			const unsigned char* data = reinterpret_cast<const unsigned char*>(bytes.data());
+			SSL_SESSION* session = d2i_SSL_SESSION(nullptr, &data, static_cast<long>(bytes.size()));
+
+			if (session == nullptr) {
+				std::cerr << "Ignoring the unreadable TLS session of " << endpoint_key << "\n";
+				continue;
+			}
+
+			if (!SSL_SESSION_is_resumable(session) || SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) <= std::time(nullptr)) {
+				SSL_SESSION_free(session); // Expired, the server would just turn it down.
+				continue;
+			}
 
-		host = config_file["connection_info"][0]["server_address"];
-		port = config_file["connection_info"][0]["server_port"];
+			tls_sessions.insert_or_assign(endpoint_key, TlsSessionPtr(session, &SSL_SESSION_free));
+		}
 	}
-	catch (const std::ifstream::failure& e) {
-		std::cerr << "Error while loading client_config.json: " << e.what() << "\n";
-		throw std::exception("Could not open client_config.json.");
+	catch (const std::exception& e) { // Also an older file that held a single session, the next handshake replaces it.
+		std::cerr << "Ignoring unreadable TLS session file " << tls_session_file << ": " << e.what() << "\n";
 	}
-	catch (const nlohmann::json::exception& e) {
-		std::cerr << "Error while parsing JSON: " << e.what() << "\n";
-		throw std::exception("Could not parse client_config.json.");
+}
+
+void ConnectionManager::save_tls_sessions() {
+	if (tls_session_file.empty())
+		return;
+
+	static constexpr char hex_digits[] = "0123456789abcdef";
+	nlohmann::json saved_sessions = nlohmann::json::object();
+
+	{
+		std::lock_guard<std::mutex> lock(tls_session_mutex);
+
+		for (auto&& [endpoint_key, tls_session] : tls_sessions) {
+			int length = tls_session != nullptr ? i2d_SSL_SESSION(tls_session.get(), nullptr) : 0;
+
+			if (length <= 0)
+				continue;
+
+			std::string bytes(length, '\0');
+			unsigned char* data = reinterpret_cast<unsigned char*>(bytes.data());
+			i2d_SSL_SESSION(tls_session.get(), &data);
+
+			std::string hex_session;
+			hex_session.reserve(bytes.size() * 2);
+
+			for (unsigned char byte : bytes) {
+				hex_session.push_back(hex_digits[byte >> 4]);
+				hex_session.push_back(hex_digits[byte & 0x0f]);
+			}
+
+			saved_sessions[endpoint_key] = std::move(hex_session);
+		}
 	}
 
-	boost::asio::ip::tcp::resolver resolver(io_context);
+	std::error_code ignored_error;
+	std::filesystem::path path(tls_session_file);
 
-	try {
-		auto endpoints = resolver.resolve(host, port);
-		boost::asio::connect(socket.next_layer(), endpoints);
+	if (path.has_parent_path())
+		std::filesystem::create_directories(path.parent_path(), ignored_error);
+
+	if (!write_private_file(path, saved_sessions.dump()))
+		std::cerr << "Could not save the TLS sessions to " << tls_session_file << "\n";
+}
+
+bool ConnectionManager::write_private_file(const std::filesystem::path& path, const std::string& contents) {
+	std::filesystem::path temporary_path = path;
+	temporary_path += ".tmp";
+
+	std::error_code file_error;
+	std::filesystem::remove(temporary_path, file_error); // Left behind by a crash, it may have been created some other way.
+
+#ifdef _WIN32
+	std::ofstream ofs(temporary_path, std::ios::binary | std::ios::trunc);
+	ofs.write(contents.data(), contents.size());
+	ofs.close();
+
+	if (!ofs)
+		return false;
+#else
+	// Created with its final permissions, so there is no moment in which someone else could open it.
+	int fd = ::open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+
+	if (fd < 0)
+		return false;
+
+	size_t written = 0;
+
+	while (written < contents.size()) {
+		ssize_t result = ::write(fd, contents.data() + written, contents.size() - written);
+
+		if (result < 0) {
+			::close(fd);
+			std::filesystem::remove(temporary_path, file_error);
+			return false;
+		}
+
+		written += static_cast<size_t>(result);
 	}
-	catch (const boost::system::system_error& e) {
-		std::cerr << "Error while connecting: " << e.what() << "\n";
-		throw std::exception("Cannot connect to the server. Please check if you are connected to a network. If you are, the server might be down.");
+
+	if (::close(fd) != 0) {
+		std::filesystem::remove(temporary_path, file_error);
+		return false;
 	}
+#endif
 
+	std::filesystem::rename(temporary_path, path, file_error); // Replaces the old file in one step.
+
+	if (file_error) {
+		std::filesystem::remove(temporary_path, file_error);
+		return false;
+	}
+
+	return true;
+}
+
+void ConnectionManager::record_handshake() {
+	auto handshake_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - handshake_started_at);
+	bool is_resumed = SSL_session_reused(socket->native_handle()) == 1;
+
+	handshake_count++;
+
+	if (is_resumed)
+		resumed_handshake_count++;
+
+	std::cerr << "TLS handshake took " << handshake_time.count() / 1000.0 << " ms (" << (is_resumed ? "resumed" : "full") << "), "
+			  << resumed_handshake_count << " of " << handshake_count << " handshake(s) resumed." << "\n";
+}
+
+void ConnectionManager::load_endpoint_latencies() {
 	try {
-		socket.handshake(boost::asio::ssl::stream_base::client);
+		std::ifstream ifs(latency_cache_file);
+
+		if (!ifs)
+			return; // Nothing measured yet.
+
+		nlohmann::json latencies = nlohmann::json::parse(ifs);
+
+		for (auto&& [key, latency_ms] : latencies.items()) {
+			if (latency_ms.is_number())
+				endpoint_latencies_ms[key] = latency_ms.get<double>();
+		}
 	}
-	catch (const boost::system::system_error& e) {
-		std::cerr << "Error during handshake: " << e.what() << "\n";
-		throw std::exception("SSL handshake with the server failed.");
+	catch (const nlohmann::json::exception& e) {
+		std::cerr << "Ignoring unreadable server latency cache: " << e.what() << "\n";
+	}
+}
+
+void ConnectionManager::save_endpoint_latencies() {
+	nlohmann::json latencies = nlohmann::json::object();
+
+	for (auto&& [key, latency_ms] : endpoint_latencies_ms) {
+		latencies[key] = latency_ms;
+	}
+
+	std::error_code ignored_error;
+	std::filesystem::create_directories(std::filesystem::path(latency_cache_file).parent_path(), ignored_error);
+
+	std::ofstream ofs(latency_cache_file, std::ios::trunc);
+	ofs << latencies.dump();
+
+	if (!ofs)
+		std::cerr << "Could not save the server latency cache to " << latency_cache_file << "\n";
+}
+
+void ConnectionManager::connect() {
+	if (server_endpoints.empty())
+		throw std::exception("There are no servers in the connection_info of client_config.json.");
+
+	configure_ssl_context();
+	load_endpoint_latencies();
+
+	// Resolving, connecting and the handshake all happen on the I/O thread. A failed first attempt is retried like a lost connection.
+	boost::asio::post(strand, [this] { start_connecting(); });
+	io_thread = std::thread([this] { io_context.run(); });
+}
+
+void ConnectionManager::shutdown() {
+	if (!io_thread.joinable())
+		return;
+
+	boost::asio::post(strand, [this] {
+		is_closing = true;
+
+		// Give queued messages (e.g. the disconnection notification) a chance to go out, but never hang on exit.
+		shutdown_timer.expires_after(std::chrono::seconds(2));
+		shutdown_timer.async_wait([this](const boost::system::error_code& timer_error) {
+			if (!timer_error)
+				io_context.stop();
+		});
+
+		// A reconnect that is waiting or underway is dropped, closing the sockets aborts whichever step they are at.
+		reconnect_timer.cancel();
+		close_connection_attempts();
+
+		if (!is_writing)
+			close_socket();
+	});
+
+	work_guard.reset();
+	io_thread.join();
+
+	if (has_new_tls_session)
+		save_tls_sessions();
+
+	if (has_new_endpoint_latency)
+		save_endpoint_latencies();
+}
+
+void ConnectionManager::close_socket() {
+	boost::system::error_code ignored_error;
+
+	has_connected = false;
+	is_heartbeat_active = false;
+	is_probe_outstanding = false;
+
+	if (socket)
+		socket->lowest_layer().close(ignored_error);
+
+	shutdown_timer.cancel();
+	heartbeat_timer.cancel();
+	dead_link_timer.cancel();
+}
+
+void ConnectionManager::schedule_reconnect() {
+	if (max_reconnect_attempts > 0 && reconnect_attempt >= max_reconnect_attempts) {
+		std::cerr << "Giving up on reconnecting after " << reconnect_attempt << " attempts." << "\n";
+
+		if (disconnection_handler)
+			disconnection_handler();
+
+		return;
+	}
+
+	// The delay doubles with every attempt up to reconnect_max_delay. A random half of it is dropped, so clients that lost the server at the same time don't all come back at once.
+	long long ceiling = reconnect_initial_delay.count() << std::min(reconnect_attempt, 20);
+	ceiling = std::min<long long>(ceiling, reconnect_max_delay.count());
+	std::chrono::milliseconds delay(std::uniform_int_distribution<long long>(ceiling / 2, ceiling)(jitter_engine));
+
+	reconnect_attempt++;
+	std::cerr << "Reconnecting in " << delay.count() << " ms (attempt " << reconnect_attempt << ")." << "\n";
+
+	reconnect_timer.expires_after(delay);
+	reconnect_timer.async_wait([this](const boost::system::error_code& timer_error) {
+		if (!timer_error && !is_closing)
+			start_connecting();
+	});
+}
+
+void ConnectionManager::start_connecting() {
+	close_connection_attempts();
+
+	// Endpoints that never won a race (or failed since) go last, in the order they are configured in.
+	race_order = server_endpoints;
+	std::stable_sort(race_order.begin(), race_order.end(), [this](const ServerEndpoint& first, const ServerEndpoint& second) {
+		auto first_latency = endpoint_latencies_ms.find(first.key());
+		auto second_latency = endpoint_latencies_ms.find(second.key());
+
+		if (second_latency == endpoint_latencies_ms.end())
+			return first_latency != endpoint_latencies_ms.end();
+
+		return first_latency != endpoint_latencies_ms.end() && first_latency->second < second_latency->second;
+	});
+
+	next_race_endpoint = 0;
+	failed_attempt_count = 0;
+	start_next_attempt();
+}
+
+void ConnectionManager::start_next_attempt() {
+	if (next_race_endpoint >= race_order.size())
+		return;
+
+	const ServerEndpoint& endpoint = race_order[next_race_endpoint++];
+	auto attempt = std::make_shared<ConnectionAttempt>(endpoint, race_generation, make_socket(endpoint), strand);
+	connection_attempts.push_back(attempt);
+
+	attempt->resolver.async_resolve(attempt->endpoint.host, attempt->endpoint.port, boost::asio::bind_executor(strand,
+		[this, attempt](const boost::system::error_code& io_error, boost::asio::ip::tcp::resolver::results_type endpoints) {
+			if (io_error) {
+				on_attempt_failed(attempt, io_error, "resolve");
+				return;
+			}
+
+			boost::asio::async_connect(attempt->socket->next_layer(), endpoints, boost::asio::bind_executor(strand,
+				[this, attempt](const boost::system::error_code& io_error, const boost::asio::ip::tcp::endpoint&) {
+					if (io_error) {
+						on_attempt_failed(attempt, io_error, "connect");
+						return;
+					}
+
+					apply_socket_options(*attempt->socket); // Before the handshake, so TCP_NODELAY already speeds that up.
+					attempt->handshake_started_at = std::chrono::steady_clock::now();
+					attempt->socket->async_handshake(boost::asio::ssl::stream_base::client, boost::asio::bind_executor(strand,
+						[this, attempt](const boost::system::error_code& io_error) {
+							if (io_error)
+								on_attempt_failed(attempt, io_error, "handshake");
+							else
+								on_attempt_succeeded(attempt);
+						}));
+				}));
+		}));
+
+	if (next_race_endpoint < race_order.size()) { // Give this one a head start before the next one joins.
+		attempt_delay_timer.expires_after(connection_attempt_delay());
+		attempt_delay_timer.async_wait([this, race = race_generation](const boost::system::error_code& timer_error) {
+			if (!timer_error && race == race_generation && !is_closing)
+				start_next_attempt();
+		});
 	}
+}
+
+void ConnectionManager::on_attempt_failed(const std::shared_ptr<ConnectionAttempt>& attempt, const boost::system::error_code& io_error, const char* stage) {
+	if (is_closing || attempt->race != race_generation) // Closed because the race is over.
+		return;
+
+	std::cerr << "Connecting to " << attempt->endpoint.key() << " failed during " << stage << ": " << io_error.message() << "\n";
+
+	boost::system::error_code ignored_error;
+	attempt->socket->lowest_layer().close(ignored_error);
+	endpoint_latencies_ms.erase(attempt->endpoint.key()); // Not tried first next time.
+	failed_attempt_count++;
+
+	if (next_race_endpoint < race_order.size()) { // Don't wait for the head start to run out.
+		attempt_delay_timer.cancel();
+		start_next_attempt();
+	}
+	else if (failed_attempt_count == race_order.size()) {
+		std::cerr << "Could not connect to any of the " << race_order.size() << " server(s)." << "\n";
+
+		close_connection_attempts();
+		schedule_reconnect();
+	}
+}
+
+void ConnectionManager::on_attempt_succeeded(const std::shared_ptr<ConnectionAttempt>& attempt) {
+	if (is_closing || attempt->race != race_generation) {
+		boost::system::error_code ignored_error;
+		attempt->socket->lowest_layer().close(ignored_error);
+		return;
+	}
+
+	auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - attempt->started_at);
+	double latency_ms = latency.count() / 1000.0;
+	auto cached_latency = endpoint_latencies_ms.find(attempt->endpoint.key());
+
+	if (cached_latency == endpoint_latencies_ms.end())
+		endpoint_latencies_ms[attempt->endpoint.key()] = latency_ms;
+	else // Smoothed, so one slow handshake doesn't make the nearest server lose its place.
+		cached_latency->second = cached_latency->second * 0.7 + latency_ms * 0.3;
+
+	has_new_endpoint_latency = true;
+	std::cerr << "Connected to " << attempt->endpoint.key() << " in " << latency_ms << " ms, " << connection_attempts.size() << " of " << race_order.size() << " server(s) tried." << "\n";
+
+	socket = std::move(attempt->socket);
+	handshake_started_at = attempt->handshake_started_at;
+	close_connection_attempts(); // The winner's socket was moved out, so only the losers are closed.
+	on_connected();
+}
 
+void ConnectionManager::close_connection_attempts() {
+	boost::system::error_code ignored_error;
+
+	race_generation++;
+	attempt_delay_timer.cancel();
+
+	for (auto&& attempt : connection_attempts) {
+		attempt->resolver.cancel();
+
+		if (attempt->socket)
+			attempt->socket->lowest_layer().close(ignored_error);
+	}
+
+	connection_attempts.clear();
+}
+
+void ConnectionManager::on_connected() {
+	if (is_closing) {
+		close_socket();
+		return;
+	}
+
+	std::cerr << "Connected to the server after " << reconnect_attempt << " retries." << "\n";
+	record_handshake();
+
+	reconnect_attempt = 0;
+	connection_generation++;
+	receive_buffer.consume(receive_buffer.size());
 	has_connected = true;
+
+	start_reading();
+
+	if (!is_writing)
+		write_next();
+
+	if (connected_handler)
+		connected_handler();
 }
 
-bool ConnectionManager::send(std::string message) {
-	boost::system::error_code io_error;
+SendResult ConnectionManager::send(std::string message) {
+	if (!has_connected) {
+		std::cerr << "Not connected, dropping a " << message.size() << " byte message." << "\n"; // Never the content, it has passwords and cookies in it.
+		release_buffer(std::move(message));
+		return SendResult::NOT_CONNECTED;
+	}
 
-	if (has_connected) {
-		boost::asio::write(socket, boost::asio::buffer(message), io_error);
+	if (queued_message_count.fetch_add(1) >= max_queued_messages) {
+		queued_message_count--;
+		std::cerr << "Outbound queue is full, dropping a " << message.size() << " byte message." << "\n";
+		release_buffer(std::move(message));
+		return SendResult::QUEUE_FULL;
+	}
 
-		if (io_error) {
-			std::cerr << "Error while sending message " << message << ", error: " << io_error.message() << "\n";
-			return false;
-		}
-		else {
-			return true;
-		}
+	boost::asio::post(strand, [this, message = std::move(message)]() mutable {
+		outbound_messages.push_back(std::move(message));
+
+		if (!is_writing)
+			write_next();
+	});
+
+	return SendResult::QUEUED;
+}
+
+std::string ConnectionManager::acquire_buffer() {
+	std::lock_guard<std::mutex> lock(buffer_pool_mutex);
+
+	if (buffer_pool.empty())
+		return std::string();
+
+	std::string buffer = std::move(buffer_pool.back());
+	buffer_pool.pop_back();
+	buffer.clear();
+
+	return buffer;
+}
+
+void ConnectionManager::release_buffer(std::string buffer) {
+	if (buffer.capacity() > max_pooled_buffer_capacity)
+		return;
+
+	std::lock_guard<std::mutex> lock(buffer_pool_mutex);
+
+	if (buffer_pool.size() < max_pooled_buffers)
+		buffer_pool.push_back(std::move(buffer));
+}
+
+void ConnectionManager::write_next() {
+	if (outbound_messages.empty() || !has_connected) {
+		is_writing = false;
+
+		if (is_closing)
+			close_socket();
+
+		return;
 	}
-	else {
-		std::cerr << "Error while sending message " << message << "not connected." << "\n";
-		return false;
+
+	// One request per write, the way the server has always received them: requests carry no delimiter, so joined ones couldn't be split apart.
+	is_writing = true;
+	boost::asio::async_write(*socket, boost::asio::buffer(outbound_messages.front()),
+		boost::asio::bind_executor(strand, [this, generation = connection_generation](const boost::system::error_code& io_error, size_t) { on_write(io_error, generation); }));
+}
+
+void ConnectionManager::on_write(const boost::system::error_code& io_error, unsigned generation) {
+	release_buffer(std::move(outbound_messages.front()));
+	outbound_messages.pop_front();
+	queued_message_count--;
+
+	if (generation != connection_generation) { // A write on a socket that was replaced, the new connection may have messages of its own waiting.
+		write_next();
+		return;
+	}
+
+	if (io_error) {
+		std::cerr << "Error while sending a message, error: " << io_error.message() << "\n";
+
+		is_writing = false;
+		queued_message_count -= outbound_messages.size();
+		outbound_messages.clear();
+		handle_io_error(io_error, "write");
+		return;
 	}
+
+	write_next();
 }
 
-std::string ConnectionManager::receive() {
-	boost::system::error_code io_error;
-	boost::asio::streambuf receive_buffer;
-
-	if (has_connected) {
-		boost::asio::read_until(socket, receive_buffer, message_delimiter, io_error);
-		if (io_error && io_error != boost::asio::error::eof) {
-			switch (io_error.value()) {
-			case boost::asio::error::connection_reset:
-				std::cerr << "Lost connection to the server." << "\n";
-				return "DISCONNECTED";
-				break;
-			case boost::asio::error::connection_aborted:
-				return "DISCONNECTED";
-				break;
-			default:
-				std::cerr << "Unhandled read error: " << io_error.message() << " Code: " << io_error.value() << "\n";
-				return "UNHANDLED_ERROR";
-			}
-		}
-		else {
-			std::string received_data = boost::asio::buffer_cast<const char*>(receive_buffer.data());
-			return received_data;
-		}
-		
+void ConnectionManager::start_reading() {
+	// Reads whatever has arrived instead of waiting for a whole frame, so partial frames count as a sign of life too.
+	socket->async_read_some(receive_buffer.prepare(read_size),
+		boost::asio::bind_executor(strand, [this, generation = connection_generation](const boost::system::error_code& io_error, size_t bytes_read) { on_read(io_error, bytes_read, generation); }));
+}
+
+void ConnectionManager::on_read(const boost::system::error_code& io_error, size_t bytes_read, unsigned generation) {
+	if (generation != connection_generation) // The read was aborted when its socket was closed, receive_buffer belongs to the new connection now.
+		return;
+
+	receive_buffer.commit(bytes_read);
+
+	if (bytes_read > 0)
+		bytes_received_at = std::chrono::steady_clock::now();
+
+	// A single read can bring in several frames, so hand out every complete one before reading again.
+	received_frames.clear();
+
+	if (extract_complete_frames(received_frames) > 0 && frames_received_handler)
+		frames_received_handler(received_frames);
+
+	if (io_error) {
+		handle_io_error(io_error, "read");
+		return;
 	}
-	else {
-		return "NOT_CONNECTED";
+
+	start_reading();
+}
+
+void ConnectionManager::handle_io_error(const boost::system::error_code& io_error, const char* operation) {
+	if (is_closing || !has_connected) // We are closing the socket on purpose, or the disconnection was already reported.
+		return;
+
+	if (io_error == boost::asio::error::connection_reset || io_error == boost::asio::error::connection_aborted)
+		std::cerr << "Lost connection to the server." << "\n";
+	else if (io_error == boost::asio::error::eof || io_error == boost::asio::ssl::error::stream_truncated)
+		std::cerr << "Server closed the connection." << "\n";
+	else if (io_error == boost::asio::error::timed_out)
+		std::cerr << "The server stopped responding." << "\n";
+	else
+		std::cerr << "Unhandled " << operation << " error: " << io_error.message() << " Code: " << io_error.value() << "\n";
+
+	close_socket();
+
+	if (connection_lost_handler)
+		connection_lost_handler();
+
+	schedule_reconnect();
+}
+
+size_t ConnectionManager::extract_complete_frames(std::vector<std::string>& frames) {
+	std::string_view buffered(static_cast<const char*>(receive_buffer.data().data()), receive_buffer.size());
+	size_t consumed = 0;
+	size_t extracted = 0;
+
+	while (true) {
+		size_t delimiter_pos = buffered.find(message_delimiter, consumed);
+
+		if (delimiter_pos == std::string_view::npos)
+			break;
+
+		frames.emplace_back(buffered.substr(consumed, delimiter_pos - consumed));
+		consumed = delimiter_pos + message_delimiter.size();
+		extracted++;
 	}
+
+	receive_buffer.consume(consumed);
+	return extracted;
 }
 
 void ConnectionManager::reset_info() {
@@ -8,30 +8,218 @@
 #include <string>
 #include <fstream>
 #include <map>
+#include <unordered_map>
+#include <vector>
+#include <utility>
+#include <deque>
+#include <string_view>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <memory>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <ctime>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include <nlohmann/json.hpp>
 
+enum class SendResult {
+	QUEUED,
+	QUEUE_FULL,
+	NOT_CONNECTED
+};
+
+using SslStream = boost::asio::ssl::stream<boost::asio::ip::tcp::socket>;
+
+// An entry of connection_info in client_config.json.
+struct ServerEndpoint {
+	std::string host;
+	std::string port;
+
+	std::string key() const { return host + ":" + port; } // Identifies the endpoint in the latency cache.
+};
+
 class ConnectionManager {
 	private:
+		/* Every socket operation runs on io_thread and goes through strand, so the GUI thread never waits on the TLS socket and
+		the reading and writing sides never touch the SSL stream at the same time. */
 		boost::asio::io_context io_context;
+		boost::asio::strand<boost::asio::io_context::executor_type> strand;
+		boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_guard;
 		boost::asio::ssl::context ssl_context;
-		boost::asio::ssl::stream<boost::asio::ip::tcp::socket> socket;
-		std::string host = "";
-		std::string port = "";
+		std::unique_ptr<SslStream> socket; // A fresh one from make_socket for every connection attempt, a used SSL stream can't connect again.
+		boost::asio::steady_timer shutdown_timer;
+		boost::asio::steady_timer reconnect_timer;
+		std::thread io_thread;
+		std::vector<ServerEndpoint> server_endpoints;
 
 		std::string message_delimiter = "\r\n\r\n";
 
+		// Lives as long as the connection does, so bytes that arrive after a delimiter are kept for the next frame.
+		boost::asio::streambuf receive_buffer;
+		std::vector<std::string> received_frames;
+		static constexpr size_t read_size = 16 * 1024; // Maximum plaintext size of a single TLS record.
+
+		// Only touched on the strand.
+		std::deque<std::string> outbound_messages; // The front one is being written while is_writing is set.
+		bool is_writing = false;
+		bool is_closing = false;
+
+		static constexpr size_t max_queued_messages = 512;
+		std::atomic<size_t> queued_message_count { 0 }; // Messages accepted by send() that haven't been written yet.
+
+		// Strings of messages that were written, handed out again by acquire_buffer so requests don't need fresh allocations.
+		std::mutex buffer_pool_mutex;
+		std::vector<std::string> buffer_pool;
+		static constexpr size_t max_pooled_buffers = 64;
+		static constexpr size_t max_pooled_buffer_capacity = 64 * 1024; // Bigger ones are freed, so one huge message doesn't stay around.
+
+		// Reconnect state machine, only touched on the strand. A lost connection is retried with jittered exponential backoff.
+		std::chrono::milliseconds reconnect_initial_delay { 500 };
+		std::chrono::milliseconds reconnect_max_delay { 30000 };
+		int max_reconnect_attempts = 20; // 0 keeps trying forever.
+		int reconnect_attempt = 0;
+		unsigned connection_generation = 0; // Bumped on every connection, so handlers of a replaced socket know to stay out.
+		std::mt19937 jitter_engine { std::random_device()() };
+
+		/* Connecting races the endpoints Happy Eyeballs style. They are started fastest first by their cached latency, each one
+		connection_attempt_delay after the previous one (or as soon as the previous one fails), and the first finished handshake wins.
+		The others are closed. Losing an endpoint is just a lost race, so failing over to the next one needs nothing extra. */
+		struct ConnectionAttempt {
+			ServerEndpoint endpoint;
+			unsigned race;
+			std::unique_ptr<SslStream> socket;
+			boost::asio::ip::tcp::resolver resolver;
+			std::chrono::steady_clock::time_point started_at;
+			std::chrono::steady_clock::time_point handshake_started_at;
+
+			ConnectionAttempt(ServerEndpoint endpoint, unsigned race, std::unique_ptr<SslStream> socket, boost::asio::strand<boost::asio::io_context::executor_type>& strand)
+				: endpoint(std::move(endpoint)), race(race), socket(std::move(socket)), resolver(strand), started_at(std::chrono::steady_clock::now()) {}
+		};
+
+		std::vector<std::shared_ptr<ConnectionAttempt>> connection_attempts; // Of the running race. The handlers hold on to their attempt, so closed ones can finish.
+		std::vector<ServerEndpoint> race_order;
+		size_t next_race_endpoint = 0;
+		size_t failed_attempt_count = 0;
+		unsigned race_generation = 0; // Bumped when a race ends, so handlers of its attempts know to stay out.
+		boost::asio::steady_timer attempt_delay_timer;
+		static constexpr std::chrono::milliseconds default_connection_attempt_delay { 250 }; // Until the heartbeat has measured the round trip time.
+
+		// Connect plus handshake time of the endpoints that won a race, by ServerEndpoint::key(). Smoothed, and kept between runs.
+		std::unordered_map<std::string, double> endpoint_latencies_ms;
+		bool has_new_endpoint_latency = false; // Saved at shutdown, not on the I/O thread for every connection.
+		static constexpr const char* latency_cache_file = "cache/server_latencies.json";
+
+		bool is_tcp_nodelay_enabled = true;
+		bool is_tcp_keepalive_enabled = true;
+
+		/* While the heartbeat is active a probe goes out every heartbeat_interval, and heartbeat_answered is told when its answer comes.
+		Any bytes that arrive count as a sign of life, so a big page on a slow link keeps the connection up while it trickles in. If nothing
+		at all arrives for dead_link_timeout while a probe is unanswered, the connection is treated as lost. That catches half-open connections
+		long before TCP does. A probe only gives a round trip time sample if nothing was waiting to be written when it was sent, since the
+		server answers in order and an earlier request would be counted too. Only touched on the strand. */
+		std::function<SendResult()> send_heartbeat_probe_request;
+		std::chrono::seconds heartbeat_interval { 15 };
+		std::chrono::seconds dead_link_timeout { 10 };
+		boost::asio::steady_timer heartbeat_timer;
+		boost::asio::steady_timer dead_link_timer;
+		bool is_heartbeat_active = false;
+		bool is_probe_outstanding = false;
+		bool is_probe_alone = false; // Nothing was queued ahead of the probe, so its answer measures the round trip time.
+		std::chrono::steady_clock::time_point probe_sent_at;
+		std::chrono::steady_clock::time_point bytes_received_at;
+		double smoothed_rtt_ms = 0; // 0 until the first probe is answered.
+
+		/* The last TLS session each endpoint handed out, a session is only good with the server that issued it. make_socket offers the
+		endpoint's session on every new socket, so reconnects (and startups, if they are kept on disk) get an abbreviated handshake. The file
+		holds the sessions' secrets: on POSIX systems it is created readable by the user only, on Windows it gets the ACL of its directory.
+		It is written once at shutdown, if a server issued a session since it was loaded. */
+		using TlsSessionPtr = std::unique_ptr<SSL_SESSION, decltype(&SSL_SESSION_free)>;
+		bool is_ssl_context_configured = false;
+		std::mutex tls_session_mutex;
+		std::map<std::string, TlsSessionPtr> tls_sessions; // By ServerEndpoint::key(). Never erased from, sockets point at the keys.
+		bool has_new_tls_session = false;
+		std::string tls_session_file; // Empty keeps the sessions in memory only.
+		std::chrono::steady_clock::time_point handshake_started_at;
+		int handshake_count = 0;
+		int resumed_handshake_count = 0;
+
+		std::function<void(std::vector<std::string>& frames)> frames_received_handler;
+		std::function<void()> connection_lost_handler;
+		std::function<void()> connected_handler;
+		std::function<void()> disconnection_handler;
+		std::function<void(int rtt_in_milliseconds)> rtt_handler;
+
+		void start_reading();
+		void on_read(const boost::system::error_code& io_error, size_t bytes_read, unsigned generation);
+		void write_next();
+		void on_write(const boost::system::error_code& io_error, unsigned generation);
+		void handle_io_error(const boost::system::error_code& io_error, const char* operation);
+		void close_socket();
+		void configure_ssl_context(); // Loads the certificate and turns on session caching, only the first time it's called.
+		std::unique_ptr<SslStream> make_socket(const ServerEndpoint& endpoint);
+		static int tls_endpoint_index(); // SSL ex_data slot with the endpoint key of a socket, Boost.Asio already uses the app data one.
+		static int on_new_tls_session(SSL* ssl, SSL_SESSION* session); // OpenSSL calls this whenever the server issues a session or ticket.
+		void load_tls_sessions();
+		void save_tls_sessions(); // Only once the I/O thread is done.
+		static bool write_private_file(const std::filesystem::path& path, const std::string& contents); // Replaces the file in one step, so it is never seen half-written.
+		void record_handshake(); // Logs how long the handshake took and whether the session was resumed.
+		void schedule_reconnect(); // Gives up and calls disconnection_handler once max_reconnect_attempts is used up.
+		void load_endpoint_latencies();
+		void save_endpoint_latencies(); // Only once the I/O thread is done.
+		void start_connecting(); // Starts a race between all endpoints.
+		void start_next_attempt(); // Resolves, connects and does the handshake with the next endpoint of the race on a new socket.
+		void on_attempt_failed(const std::shared_ptr<ConnectionAttempt>& attempt, const boost::system::error_code& io_error, const char* stage);
+		void on_attempt_succeeded(const std::shared_ptr<ConnectionAttempt>& attempt);
+		void close_connection_attempts(); // Ends the running race.
+		std::chrono::milliseconds connection_attempt_delay() const; // Twice the round trip time, within 100 ms and 2 s.
+		void apply_socket_options(SslStream& new_socket);
+		void schedule_heartbeat();
+		void send_heartbeat_probe();
+		void wait_for_sign_of_life(); // Arms dead_link_timer for dead_link_timeout after the probe or the last bytes received, whichever is later.
+		void on_connected();
+		size_t extract_complete_frames(std::vector<std::string>& frames); // Moves every complete frame in receive_buffer to frames, returns how many were moved.
+		void release_buffer(std::string buffer);
+
 	public:
-		bool has_connected = false;
+		std::atomic<bool> has_connected { false };
 		
 		std::string username = "";
 		std::string session_cookie = "";
 		bool has_logged_in = false;
 
 		ConnectionManager();
-		bool send(std::string message); // Returns false on failure and true on success.
-		std::string receive(); // Returns the data received.
-		void connect();
+		~ConnectionManager();
+
+		/* All handlers are called on the I/O thread. The connected handler is called after every successful connection, the first one included,
+		the connection lost handler when reconnecting starts and the disconnection handler once it is given up. */
+		void set_frames_received_handler(std::function<void(std::vector<std::string>& frames)> handler);
+		void set_connection_lost_handler(std::function<void()> handler);
+		void set_connected_handler(std::function<void()> handler);
+		void set_disconnection_handler(std::function<void()> handler);
+		void set_endpoints(const std::vector<std::pair<std::string, std::string>>& addresses_and_ports); // Call before connect(), which throws if there are none.
+		void set_reconnect_policy(std::chrono::milliseconds initial_delay, std::chrono::milliseconds max_delay, int max_attempts); // Call before connect().
+		void set_tls_session_file(std::string path); // Call before connect().
+		void set_socket_options(bool tcp_nodelay, bool tcp_keepalive); // Call before connect().
+		/* send_probe is called on the I/O thread and sends the probe through send(). The server must answer every probe with exactly one
+		response, in the order the requests were written, and the caller must be able to tell that response apart from the answers to
+		its other requests, e.g. by counting the requests of that type it has outstanding. Call before connect(). */
+		void set_heartbeat(std::function<SendResult()> send_probe, std::chrono::seconds interval, std::chrono::seconds timeout);
+		void heartbeat_answered(); // Only call from the frames received handler, for the frame that answers a probe.
+		void set_rtt_handler(std::function<void(int rtt_in_milliseconds)> handler); // Called on the I/O thread with the smoothed round trip time.
+		void set_heartbeat_active(bool is_active); // Only turn it on once logged in, the heartbeat stops on its own when the connection is lost.
+
+		SendResult send(std::string message); // Frames the message and queues it for the I/O thread without blocking.
+		std::string acquire_buffer(); // An empty string to build the next message in, with the capacity of one that was already sent. Thread-safe.
+		void connect(); // Loads the settings and starts connecting on the I/O thread without waiting for it. Throws if the settings can't be loaded.
+		void shutdown(); // Flushes queued messages (waiting for 2 seconds at most) and stops the I/O thread.
 		void reset_info();
 };
\ No newline at end of file
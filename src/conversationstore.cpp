@@ -0,0 +1,281 @@
+#include "conversationstore.h"
+
+#include <algorithm>
+
+size_t Conversation::estimate_content_memory_usage(const StoredMessage& message) {
+	return message.content.capacity();
+}
+
+void Conversation::append(StoredMessage message) {
+	content_memory_usage += estimate_content_memory_usage(message);
+	messages.push_back(std::move(message));
+}
+
+void Conversation::replace_history(std::vector<StoredMessage>& oldest_first_messages) {
+	remove_delivered_pending(oldest_first_messages);
+
+	older_messages.clear();
+	messages.clear();
+	has_oldest_message = false;
+	content_memory_usage = 0;
+
+	for (auto&& pending_message : pending_messages) {
+		content_memory_usage += estimate_content_memory_usage(pending_message.message);
+	}
+
+	for (auto&& message : oldest_first_messages) {
+		append(std::move(message));
+	}
+
+	oldest_first_messages.clear();
+}
+
+size_t Conversation::prepend_older(std::vector<StoredMessage>& oldest_first_messages) {
+	// Pages are counted back from the newest message, so messages that arrived since the last page can push its tail into what's stored.
+	size_t new_message_count = oldest_first_messages.size();
+
+	while (new_message_count > 0 && contains_at_start(oldest_first_messages[new_message_count - 1])) {
+		new_message_count--;
+	}
+
+	for (size_t i = new_message_count; i > 0; i--) {
+		content_memory_usage += estimate_content_memory_usage(oldest_first_messages[i - 1]);
+		older_messages.push_back(std::move(oldest_first_messages[i - 1]));
+	}
+
+	oldest_first_messages.clear();
+	return new_message_count;
+}
+
+bool Conversation::contains_at_start(const StoredMessage& message) const {
+	for (size_t i = 0; i < server_message_count() && at(i).sent_at <= message.sent_at; i++) {
+		const StoredMessage& stored_message = at(i);
+
+		if (stored_message.sent_at == message.sent_at && stored_message.sent_by == message.sent_by && stored_message.content == message.content)
+			return true;
+	}
+
+	return false;
+}
+
+bool Conversation::contains_at_end(const StoredMessage& message) const {
+	for (size_t i = server_message_count(); i > 0 && at(i - 1).sent_at >= message.sent_at; i--) {
+		const StoredMessage& stored_message = at(i - 1);
+
+		if (stored_message.sent_at == message.sent_at && stored_message.sent_by == message.sent_by && stored_message.content == message.content)
+			return true;
+	}
+
+	return false;
+}
+
+bool Conversation::merge_newest(std::vector<StoredMessage>& oldest_first_messages, std::vector<StoredMessage>& appended_messages) {
+	appended_messages.clear();
+
+	if (server_message_count() == 0) {
+		for (auto&& message : oldest_first_messages) {
+			appended_messages.push_back(message);
+			append(std::move(message));
+		}
+
+		oldest_first_messages.clear();
+		remove_delivered_pending(appended_messages);
+		return true;
+	}
+
+	unsigned long long last_sent_at = at(server_message_count() - 1).sent_at;
+	size_t first_new_message = 0;
+
+	// Everything up to the last message that is already stored is skipped, the page only overlaps the stored messages if there is one.
+	for (size_t i = 0; i < oldest_first_messages.size(); i++) {
+		const StoredMessage& message = oldest_first_messages[i];
+
+		if (message.sent_at < last_sent_at || (message.sent_at == last_sent_at && contains_at_end(message)))
+			first_new_message = i + 1;
+	}
+
+	if (first_new_message == 0)
+		return false;
+
+	for (size_t i = first_new_message; i < oldest_first_messages.size(); i++) {
+		appended_messages.push_back(oldest_first_messages[i]);
+		append(std::move(oldest_first_messages[i]));
+	}
+
+	oldest_first_messages.clear();
+	remove_delivered_pending(appended_messages);
+	return true;
+}
+
+void Conversation::remove_delivered_pending(const std::vector<StoredMessage>& oldest_first_messages) {
+	// The server stamps messages with its own clock, so only the sender and the content can tell which one is the copy. Both lists are in send order.
+	size_t next_message = 0;
+
+	for (auto pending_message = pending_messages.begin(); pending_message != pending_messages.end();) {
+		auto is_copy = [&](const StoredMessage& message) { return message.sent_by == pending_message->message.sent_by && message.content == pending_message->message.content; };
+		auto copy = std::find_if(oldest_first_messages.begin() + next_message, oldest_first_messages.end(), is_copy);
+
+		if (copy == oldest_first_messages.end()) {
+			++pending_message;
+			continue;
+		}
+
+		next_message = static_cast<size_t>(copy - oldest_first_messages.begin()) + 1;
+		content_memory_usage -= estimate_content_memory_usage(pending_message->message);
+		pending_message = pending_messages.erase(pending_message);
+	}
+}
+
+void Conversation::add_pending(uint64_t send_id, StoredMessage message) {
+	content_memory_usage += estimate_content_memory_usage(message);
+	pending_messages.push_back(PendingMessage{ send_id, std::move(message), false });
+}
+
+void Conversation::remove_pending(uint64_t send_id) {
+	auto pending_message = std::find_if(pending_messages.begin(), pending_messages.end(), [send_id](const PendingMessage& pending) { return pending.send_id == send_id; });
+
+	if (pending_message == pending_messages.end())
+		return;
+
+	content_memory_usage -= estimate_content_memory_usage(pending_message->message);
+	pending_messages.erase(pending_message);
+}
+
+void Conversation::confirm_pending(uint64_t send_id) {
+	auto pending_message = std::find_if(pending_messages.begin(), pending_messages.end(), [send_id](const PendingMessage& pending) { return pending.send_id == send_id; });
+
+	if (pending_message != pending_messages.end())
+		pending_message->is_confirmed = true;
+}
+
+bool Conversation::has_pending(uint64_t send_id) const {
+	return std::any_of(pending_messages.begin(), pending_messages.end(), [send_id](const PendingMessage& pending) { return pending.send_id == send_id; });
+}
+
+bool Conversation::has_confirmed_pending() const {
+	return std::any_of(pending_messages.begin(), pending_messages.end(), [](const PendingMessage& pending) { return pending.is_confirmed; });
+}
+
+size_t Conversation::pending_count() const {
+	return pending_messages.size();
+}
+
+void Conversation::mark_complete() {
+	has_oldest_message = true;
+}
+
+bool Conversation::is_complete() const {
+	return has_oldest_message;
+}
+
+const StoredMessage& Conversation::at(size_t index) const {
+	if (index < older_messages.size())
+		return older_messages[older_messages.size() - 1 - index];
+
+	if (index < server_message_count())
+		return messages[index - older_messages.size()];
+
+	return pending_messages[index - server_message_count()].message;
+}
+
+size_t Conversation::size() const {
+	return server_message_count() + pending_messages.size();
+}
+
+size_t Conversation::server_message_count() const {
+	return older_messages.size() + messages.size();
+}
+
+size_t Conversation::get_memory_usage() const {
+	size_t message_slots = older_messages.capacity() + messages.capacity();
+	return content_memory_usage + message_slots * sizeof(StoredMessage) + pending_messages.size() * sizeof(PendingMessage);
+}
+
+Conversation* ConversationStore::find(const QString& friend_username) {
+	auto it = conversations.find(friend_username);
+	return it != conversations.end() ? &it->second : nullptr;
+}
+
+Conversation& ConversationStore::set_history(const QString& friend_username, std::vector<StoredMessage>& oldest_first_messages) {
+	Conversation& conversation = conversations[friend_username];
+	conversation.replace_history(oldest_first_messages);
+	return conversation;
+}
+
+bool ConversationStore::append(const QString& friend_username, StoredMessage message) {
+	Conversation* conversation = find(friend_username);
+
+	if (conversation == nullptr)
+		return false;
+
+	conversation->append(std::move(message));
+	return true;
+}
+
+void ConversationStore::remove(const QString& friend_username) {
+	conversations.erase(friend_username);
+}
+
+void ConversationStore::clear() {
+	conversations.clear();
+}
+
+void ConversationStore::mark_viewed(const QString& friend_username) {
+	Conversation* conversation = find(friend_username);
+
+	if (conversation != nullptr)
+		conversation->last_viewed = ++view_counter;
+}
+
+size_t ConversationStore::get_memory_usage() const {
+	size_t memory_usage = 0;
+
+	for (auto&& [friend_username, conversation] : conversations) {
+		memory_usage += conversation.get_memory_usage();
+	}
+
+	return memory_usage;
+}
+
+size_t ConversationStore::get_conversation_count() const {
+	return conversations.size();
+}
+
+std::vector<QString> ConversationStore::get_loaded_friends() const {
+	std::vector<QString> friend_usernames;
+	friend_usernames.reserve(conversations.size());
+
+	for (auto&& [friend_username, conversation] : conversations) {
+		friend_usernames.push_back(friend_username);
+	}
+
+	return friend_usernames;
+}
+
+std::vector<QString> ConversationStore::evict_to_budget(size_t memory_budget, const std::function<bool(const QString&)>& can_evict) {
+	std::vector<QString> evicted_friends;
+	size_t memory_usage = get_memory_usage();
+
+	if (memory_usage <= memory_budget)
+		return evicted_friends;
+
+	std::vector<std::pair<unsigned long long, QString>> candidates;
+
+	for (auto&& [friend_username, conversation] : conversations) {
+		if (can_evict(friend_username))
+			candidates.emplace_back(conversation.last_viewed, friend_username);
+	}
+
+	std::sort(candidates.begin(), candidates.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+	for (auto&& [last_viewed, friend_username] : candidates) {
+		if (memory_usage <= memory_budget)
+			break;
+
+		memory_usage -= conversations.at(friend_username).get_memory_usage();
+		conversations.erase(friend_username);
+		evicted_friends.push_back(friend_username);
+	}
+
+	return evicted_friends;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <QString>
+#include <QHash>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <deque>
+#include <functional>
+
+struct StoredMessage {
+	unsigned long long sent_at; // Unix time, formatted only when the message is shown.
+	uint32_t sent_by; // Id in the UsernameTable.
+	std::string content; // UTF-8 like the server sends it, converted to a QString only when the message is shown.
+};
+
+// Append-only list made of fixed-size chunks. Appending never moves stored elements, so references to them stay valid.
+template <typename T, size_t chunk_size = 256>
+class ChunkedList {
+	private:
+		std::vector<std::unique_ptr<std::vector<T>>> chunks;
+		size_t element_count = 0;
+
+	public:
+		void push_back(T element) {
+			if (chunks.empty() || chunks.back()->size() == chunk_size) {
+				chunks.emplace_back(std::make_unique<std::vector<T>>());
+				chunks.back()->reserve(chunk_size);
+			}
+
+			chunks.back()->emplace_back(std::move(element));
+			element_count++;
+		}
+
+		const T& operator[](size_t index) const {
+			return (*chunks[index / chunk_size])[index % chunk_size];
+		}
+
+		size_t size() const {
+			return element_count;
+		}
+
+		size_t capacity() const { // Every chunk reserves room for chunk_size elements up front.
+			return chunks.size() * chunk_size;
+		}
+
+		void clear() {
+			chunks.clear();
+			element_count = 0;
+		}
+};
+
+// A message we sent that the server's history doesn't have yet. Its sent_at is our own clock, so it never goes into the cache.
+struct PendingMessage {
+	uint64_t send_id;
+	StoredMessage message;
+	bool is_confirmed = false; // The server accepted it, the next page brings its copy.
+};
+
+/* Message history with a single friend, oldest message first. Older pages are kept in their own list, newest first, so prepending
+a page doesn't move anything either. Pending messages come after everything the server sent. */
+class Conversation {
+	private:
+		ChunkedList<StoredMessage> older_messages; // Newest first, everything that was prepended.
+		ChunkedList<StoredMessage> messages; // Oldest first.
+		std::deque<PendingMessage> pending_messages; // Oldest first.
+		bool has_oldest_message = false;
+		size_t content_memory_usage = 0; // The message slots are counted from the allocated chunks instead.
+
+		static size_t estimate_content_memory_usage(const StoredMessage& message);
+		bool contains_at_start(const StoredMessage& message) const;
+		bool contains_at_end(const StoredMessage& message) const;
+		void remove_delivered_pending(const std::vector<StoredMessage>& oldest_first_messages); // Drops the pending messages the server's copies arrived for.
+
+	public:
+		void append(StoredMessage message);
+		void replace_history(std::vector<StoredMessage>& oldest_first_messages); // Moves the messages out of the vector.
+		size_t prepend_older(std::vector<StoredMessage>& oldest_first_messages); // Skips messages that are already stored, returns how many were prepended.
+
+		/* Appends the messages of the newest page that are newer than the last stored one and moves them into appended_messages as well.
+		Returns false without touching anything if the page doesn't reach back to the stored messages, i.e. there may be a gap in between. */
+		bool merge_newest(std::vector<StoredMessage>& oldest_first_messages, std::vector<StoredMessage>& appended_messages);
+
+		// Pending messages stay until a page brings the server's copy of them.
+		void add_pending(uint64_t send_id, StoredMessage message);
+		void remove_pending(uint64_t send_id); // Does nothing if the server's copy already replaced it.
+		void confirm_pending(uint64_t send_id);
+		bool has_pending(uint64_t send_id) const;
+		bool has_confirmed_pending() const;
+		size_t pending_count() const;
+
+		void mark_complete(); // The server has no messages older than the ones stored.
+		bool is_complete() const;
+
+		const StoredMessage& at(size_t index) const; // Pending messages are at the end.
+		size_t size() const; // Including pending messages.
+		size_t server_message_count() const;
+		size_t get_memory_usage() const; // Estimated bytes used by the messages.
+
+		unsigned long long last_viewed = 0; // Set by ConversationStore::mark_viewed.
+};
+
+struct QStringHasher {
+	size_t operator()(const QString& string) const {
+		return qHash(string);
+	}
+};
+
+// Every loaded conversation, keyed by friend username. A friend without an entry hasn't had their history fetched yet.
+class ConversationStore {
+	private:
+		std::unordered_map<QString, Conversation, QStringHasher> conversations; // Node based, so Conversation pointers survive rehashing.
+		unsigned long long view_counter = 0;
+
+	public:
+		Conversation* find(const QString& friend_username); // Returns nullptr if the history isn't loaded.
+		Conversation& set_history(const QString& friend_username, std::vector<StoredMessage>& oldest_first_messages);
+		bool append(const QString& friend_username, StoredMessage message); // Returns false (and drops the message) if the history isn't loaded.
+		void remove(const QString& friend_username);
+		void clear();
+
+		void mark_viewed(const QString& friend_username);
+		size_t get_memory_usage() const;
+		size_t get_conversation_count() const;
+		std::vector<QString> get_loaded_friends() const;
+
+		/* Removes the least recently viewed conversations until the estimated memory usage fits in memory_budget, skipping the ones
+		can_evict returns false for. Returns the usernames of the evicted conversations. */
+		std::vector<QString> evict_to_budget(size_t memory_budget, const std::function<bool(const QString&)>& can_evict);
+};
@@ -1,5 +1,10 @@
 #include "globals.h"
 
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
 int Globals::UI::show_popup_window(QString string, QString window_name, QMessageBox::Icon icon, QString custom_button_text) {
 	QMessageBox message_box;
 	message_box.setWindowTitle(window_name);
@@ -20,12 +25,147 @@ int Globals::UI::show_popup_question_window(QWidget* parent, QString window_titl
 	return reply;
 }
 
+namespace {
+	std::chrono::steady_clock::time_point process_started_at = std::chrono::steady_clock::now(); // Until main calls mark_process_start.
+	std::chrono::steady_clock::time_point last_milestone_at = process_started_at;
+	std::vector<const char*> reached_milestones;
+}
+
+void Globals::startup::mark_process_start() {
+	process_started_at = std::chrono::steady_clock::now();
+	last_milestone_at = process_started_at;
+}
+
+void Globals::startup::mark(const char* milestone) {
+	auto is_same_milestone = [milestone](const char* reached) { return std::strcmp(reached, milestone) == 0; };
+
+	if (std::any_of(reached_milestones.begin(), reached_milestones.end(), is_same_milestone))
+		return;
+
+	auto now = std::chrono::steady_clock::now();
+	auto since_start = std::chrono::duration_cast<std::chrono::milliseconds>(now - process_started_at);
+	auto since_previous = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_milestone_at);
+
+	std::cerr << "Startup: " << milestone << " after " << since_start.count() << " ms (+" << since_previous.count() << " ms)." << "\n";
+
+	reached_milestones.push_back(milestone);
+	last_milestone_at = now;
+}
+
+namespace {
+	// A local day with a single UTC offset, [day_start, day_end) in unix time, and its formatted date.
+	struct CachedDay {
+		long long day_start = 0;
+		long long day_end = 0;
+		char date[11] = {}; // "dd/mm/YYYY"
+	};
+
+	constexpr size_t cached_day_count = 8;
+	constexpr long long seconds_per_day = 86400;
+
+	// Days since 1970-01-01 of a date in the proleptic Gregorian calendar.
+	long long days_from_civil(long long year, unsigned month, unsigned day) {
+		year -= month <= 2;
+		long long era = (year >= 0 ? year : year - 399) / 400;
+		unsigned year_of_era = static_cast<unsigned>(year - era * 400);
+		unsigned day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+		unsigned day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+		return era * 146097 + static_cast<long long>(day_of_era) - 719468;
+	}
+
+	bool to_local_time(long long unix_time, std::tm& local_time) {
+		std::time_t time = static_cast<std::time_t>(unix_time);
+#ifdef _WIN32
+		return localtime_s(&local_time, &time) == 0;
+#else
+		return localtime_r(&time, &local_time) != nullptr;
+#endif
+	}
+
+	long long utc_offset_of(long long unix_time, const std::tm& local_time) {
+		long long local_seconds = days_from_civil(local_time.tm_year + 1900LL, local_time.tm_mon + 1, local_time.tm_mday) * seconds_per_day
+			+ local_time.tm_hour * 3600LL + local_time.tm_min * 60LL + local_time.tm_sec;
+		return local_seconds - unix_time;
+	}
+
+	void write_two_digits(char* out, int value) {
+		out[0] = static_cast<char>('0' + value / 10);
+		out[1] = static_cast<char>('0' + value % 10);
+	}
+
+	// Fills in the day unix_time is in. Returns false on days whose UTC offset changes (DST switches), those aren't cached.
+	bool load_day(long long unix_time, CachedDay& day) {
+		std::tm local_time {};
+
+		if (!to_local_time(unix_time, local_time))
+			return false;
+
+		long long utc_offset = utc_offset_of(unix_time, local_time);
+		day.day_start = unix_time - (local_time.tm_hour * 3600LL + local_time.tm_min * 60LL + local_time.tm_sec);
+		day.day_end = day.day_start + seconds_per_day;
+
+		// The day only starts and ends where the arithmetic above says if the offset is the same all day long.
+		std::tm first_second_of_day {};
+		std::tm last_second_of_day {};
+
+		if (!to_local_time(day.day_start, first_second_of_day) || utc_offset_of(day.day_start, first_second_of_day) != utc_offset ||
+			!to_local_time(day.day_end - 1, last_second_of_day) || utc_offset_of(day.day_end - 1, last_second_of_day) != utc_offset)
+			return false;
+
+		write_two_digits(day.date, local_time.tm_mday);
+		day.date[2] = '/';
+		write_two_digits(day.date + 3, local_time.tm_mon + 1);
+		day.date[5] = '/';
+		std::snprintf(day.date + 6, 5, "%04d", (local_time.tm_year + 1900) % 10000);
+
+		return true;
+	}
+}
+
 std::string Globals::time::unix_time_to_readable_string(unsigned long long unix_time) {
-	std::time_t time = unix_time;
-	std::tm* time_tm_structure = std::localtime(&time);
-	char buffer[100];
-	std::strftime(buffer, sizeof(buffer), "%d/%m/%Y %T", time_tm_structure);
-	return std::string(buffer);
+	thread_local CachedDay cached_days[cached_day_count];
+	thread_local size_t next_slot = 0;
+
+	long long time = static_cast<long long>(unix_time);
+	const CachedDay* day = nullptr;
+
+	for (auto&& cached_day : cached_days) {
+		if (time >= cached_day.day_start && time < cached_day.day_end) {
+			day = &cached_day;
+			break;
+		}
+	}
+
+	if (day == nullptr) {
+		CachedDay loaded_day;
+
+		if (!load_day(time, loaded_day)) { // Rare enough to just ask the C library every time.
+			std::tm local_time {};
+			char buffer[100] = {};
+
+			if (to_local_time(time, local_time))
+				std::strftime(buffer, sizeof(buffer), "%d/%m/%Y %T", &local_time);
+
+			return std::string(buffer);
+		}
+
+		cached_days[next_slot] = loaded_day;
+		day = &cached_days[next_slot];
+		next_slot = (next_slot + 1) % cached_day_count;
+	}
+
+	long long second_of_day = time - day->day_start;
+	char buffer[20];
+
+	std::memcpy(buffer, day->date, 10);
+	buffer[10] = ' ';
+	write_two_digits(buffer + 11, static_cast<int>(second_of_day / 3600));
+	buffer[13] = ':';
+	write_two_digits(buffer + 14, static_cast<int>(second_of_day / 60 % 60));
+	buffer[16] = ':';
+	write_two_digits(buffer + 17, static_cast<int>(second_of_day % 60));
+
+	return std::string(buffer, 19);
 }
 
 QString Globals::generate_message(QString sent_at, QString sent_by, QString message_content) {
@@ -33,9 +173,5 @@ QString Globals::generate_message(QString sent_at, QString sent_by, QString mess
 }
 
 std::string Globals::time::current_time_as_readable_string() {
-	std::time_t time_now = std::time(nullptr);
-	std::tm* time_tm_structure = std::localtime(&time_now);
-	char buffer[100];
-	std::strftime(buffer, sizeof(buffer), "%d/%m/%Y %T", time_tm_structure);
-	return std::string(buffer);
-}
\ No newline at end of file
+	return unix_time_to_readable_string(static_cast<unsigned long long>(std::time(nullptr)));
+}
@@ -3,6 +3,7 @@
 #include <iostream> // todo temp
 #include <string>
 #include <ctime>
+#include <chrono>
 #include <QMessageBox>
 #include <QApplication>
 #include <QString> 
@@ -16,7 +17,15 @@ namespace Globals {
 		int show_popup_question_window(QWidget* parent, QString window_title, QString window_text, bool do_beep);
 	}
 
+	// Cold start timing, only used on the GUI thread.
+	namespace startup {
+		void mark_process_start(); // Called first thing in main, the milestones are measured from here.
+		void mark(const char* milestone); // Logs the time since process start and since the previous milestone, only the first time a milestone is reached.
+	}
+
 	namespace time {
+		/* Formats as "dd/mm/YYYY HH:MM:SS" in local time. The date and UTC offset of the last few days seen are cached per thread, so
+		most calls are only arithmetic and the function is safe to call from any thread. */
 		std::string unix_time_to_readable_string(unsigned long long unix_time);
 		std::string current_time_as_readable_string();
 	}
@@ -0,0 +1,78 @@
+#include "historydecoder.h"
+
+#include <algorithm>
+#include <thread>
+
+HistoryDecoder::HistoryDecoder(std::function<void(DecodedHistoryPage& page)> page_decoded_handler)
+	: pool(std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u)), page_decoded_handler(std::move(page_decoded_handler)) {
+}
+
+HistoryDecoder::~HistoryDecoder() {
+	join();
+}
+
+void HistoryDecoder::submit(QString friend_username, int max_index, std::vector<std::string> newest_first_entries) {
+	auto job = std::make_shared<PageJob>();
+	job->page_number = next_page_number++;
+	job->friend_username = std::move(friend_username);
+	job->max_index = max_index;
+	job->newest_first_entries = std::move(newest_first_entries);
+	job->decoded_messages.resize(job->newest_first_entries.size());
+	job->is_decoded.resize(job->newest_first_entries.size(), false);
+
+	size_t entry_count = job->newest_first_entries.size();
+	size_t chunk_count = std::max<size_t>(1, (entry_count + entries_per_chunk - 1) / entries_per_chunk); // Empty pages still need publishing.
+	job->remaining_chunks = chunk_count;
+
+	for (size_t chunk = 0; chunk < chunk_count; chunk++) {
+		size_t first_entry = chunk * entries_per_chunk;
+		size_t last_entry = std::min(entry_count, first_entry + entries_per_chunk);
+
+		boost::asio::post(pool, [this, job, first_entry, last_entry] { decode_chunk(job, first_entry, last_entry); });
+	}
+}
+
+void HistoryDecoder::decode_chunk(const std::shared_ptr<PageJob>& job, size_t first_entry, size_t last_entry) {
+	size_t entry_count = job->newest_first_entries.size();
+
+	for (size_t i = first_entry; i < last_entry; i++) {
+		HistoryEntry entry;
+		std::string error;
+
+		if (!decode_history_entry(job->newest_first_entries[i], entry, error)) {
+			std::cerr << "--- RECEIVED UNPARSABLE HISTORY ENTRY: " << job->newest_first_entries[i] << " (" << error << ") ---" << "\n";
+			continue;
+		}
+
+		// The server sends the newest message first, the store keeps the oldest message first.
+		job->decoded_messages[entry_count - 1 - i] = StoredMessage{ entry.sent_at, UsernameTable::instance().intern_utf8(entry.sent_by), std::move(entry.message_content) };
+		job->is_decoded[entry_count - 1 - i] = true;
+	}
+
+	if (job->remaining_chunks.fetch_sub(1) == 1) // The last chunk to finish publishes the page.
+		finish_page(*job);
+}
+
+void HistoryDecoder::finish_page(PageJob& job) {
+	DecodedHistoryPage page;
+	page.friend_username = std::move(job.friend_username);
+	page.max_index = job.max_index;
+	page.oldest_first_messages.reserve(job.decoded_messages.size());
+
+	for (size_t i = 0; i < job.decoded_messages.size(); i++) {
+		if (job.is_decoded[i])
+			page.oldest_first_messages.push_back(std::move(job.decoded_messages[i]));
+	}
+
+	std::lock_guard<std::mutex> lock(publish_mutex);
+	finished_pages.emplace(job.page_number, std::move(page));
+
+	for (auto it = finished_pages.begin(); it != finished_pages.end() && it->first == next_page_to_publish; it = finished_pages.erase(it)) {
+		page_decoded_handler(it->second);
+		next_page_to_publish++;
+	}
+}
+
+void HistoryDecoder::join() {
+	pool.join();
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#ifdef _WIN32
+#include <sdkddkver.h> // Gets rid of Boost's "please define target" warnings on Windows.
+#endif
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/asio/post.hpp>
+#include <QString>
+#include "servermessages.h"
+#include "conversationstore.h"
+#include "usernametable.h"
+
+struct DecodedHistoryPage {
+	QString friend_username;
+	int max_index = 0; // The max_index the page was requested with.
+	std::vector<StoredMessage> oldest_first_messages;
+};
+
+/* Decodes the entries of fetch-messages-request-response pages on a small worker pool, so a page of history doesn't hold up the message
+processor thread. Pages are published in the order they were submitted, whichever one finishes decoding first. */
+class HistoryDecoder {
+	private:
+		struct PageJob {
+			unsigned long long page_number = 0;
+			QString friend_username;
+			int max_index = 0;
+			std::vector<std::string> newest_first_entries;
+			std::vector<StoredMessage> decoded_messages; // Oldest first, same size as newest_first_entries.
+			std::vector<char> is_decoded;
+			std::atomic<size_t> remaining_chunks { 0 };
+		};
+
+		static constexpr size_t entries_per_chunk = 25;
+
+		boost::asio::thread_pool pool;
+		std::function<void(DecodedHistoryPage& page)> page_decoded_handler;
+
+		std::mutex publish_mutex;
+		unsigned long long next_page_number = 0; // Only touched by the submitting thread.
+		unsigned long long next_page_to_publish = 0;
+		std::map<unsigned long long, DecodedHistoryPage> finished_pages; // Pages that are done but still waiting for an earlier one.
+
+		void decode_chunk(const std::shared_ptr<PageJob>& job, size_t first_entry, size_t last_entry);
+		void finish_page(PageJob& job);
+
+	public:
+		// page_decoded_handler is called on a worker thread, one page at a time and in submission order.
+		HistoryDecoder(std::function<void(DecodedHistoryPage& page)> page_decoded_handler);
+		~HistoryDecoder();
+
+		void submit(QString friend_username, int max_index, std::vector<std::string> newest_first_entries); // Must always be called from the same thread.
+		void join(); // Waits for every submitted page to be published.
+};
@@ -10,6 +10,10 @@ LoginWindow::LoginWindow(QWidget *parent)
     ui.github_button->setIcon(github_icon);
 }
 
+void LoginWindow::show_connection_status(const QString& status) {
+    ui.connection_status_label->setText(status);
+}
+
 void LoginWindow::on_RegisterButtonClick() {
     emit swap_to_register_window();
 }
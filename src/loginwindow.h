@@ -15,6 +15,7 @@ class LoginWindow : public QWidget
 public:
     virtual void keyPressEvent(QKeyEvent* event);
     LoginWindow(QWidget *parent = Q_NULLPTR);
+    void show_connection_status(const QString& status); // The window is up before the connection is, so the user can see when logging in will work.
 
 signals:
     void swap_to_register_window();
@@ -2,6 +2,8 @@
 #include "mainwidget.h"
 
 int main(int argc, char* argv[]) {
+	Globals::startup::mark_process_start();
+
 	try {
 		QApplication a(argc, argv);
 		MainWidget main_widget;
@@ -1,14 +1,14 @@
 #include "mainwidget.h"
 
 MainWidget::MainWidget(QWidget *parent) : QStackedWidget(parent), 
-										  network_thread(&MainWidget::receive_and_parse_forever, this), 
-										  message_processor_thread(&MainWidget::process_received_forever, this),
-										  friend_status_checker_thread(&MainWidget::check_friend_statuses_forever, this) {
+										  history_decoder([this](DecodedHistoryPage& page) {
+											  queue_ui_update([this, page = std::move(page)]() mutable { history_page_decoded(page); });
+										  }),
+										  message_processor_thread(&MainWidget::process_received_forever, this) {
 	// Need to do this to be able to pass these object types through Qt signals.
-	qRegisterMetaType<std::vector<std::string>>("std::vector<std::string>");
+	qRegisterMetaType<LoginSnapshot>("LoginSnapshot");
 	qRegisterMetaType<QMessageBox::Icon>("QMessageBox::Icon");
 	qRegisterMetaType<QVector<int>>("QVector<int>");
-	qRegisterMetaType<nlohmann::json>("nlohmann::json");
 	qRegisterMetaType<SoundEffect>("SoundEffect");
 
 	ui.setupUi(this);
@@ -16,8 +16,20 @@ MainWidget::MainWidget(QWidget *parent) : QStackedWidget(parent),
 	addWidget(&register_window);
 	addWidget(&chat_window);
 
+	// Updates queued by the message processor thread are applied together, at most once per frame.
+	ui_flush_timer.setSingleShot(true);
+	ui_flush_timer.setInterval(16);
+	connect(&ui_flush_timer, &QTimer::timeout, this, &MainWidget::flush_ui_updates);
+
+	// Statuses are fetched once after logging in and then only resynced every now and then, get-status-response updates come in between.
+	client_config = ClientConfig::load();
+	presence_resync_timer.setInterval(client_config.presence_resync_interval_seconds * 1000);
+	connect(&presence_resync_timer, &QTimer::timeout, this, &MainWidget::request_friend_statuses);
+
+	chat_window.set_memory_budget(client_config.conversation_memory_budget_mb * 1024 * 1024);
+
 	setCurrentIndex(0); // Launch to the login screen.
-	setWindowTitle("Konkon - Login");
+	update_window_title();
 
 	// Set up screen switching signals.
 	connect(&login_window, &LoginWindow::swap_to_register_window, this, &MainWidget::swap_to_register_window);
@@ -26,10 +38,7 @@ MainWidget::MainWidget(QWidget *parent) : QStackedWidget(parent),
 	// Set up popup message signals that come from other threads.
 	connect(this, &MainWidget::sig_show_popup_message, this, &MainWidget::slot_show_popup_message);
 	connect(this, &MainWidget::forced_logout_signal, this, &MainWidget::forced_logout_handler);
-	connect(this, &MainWidget::update_chatbox_signal, this, &MainWidget::update_chatbox_slot);
-	connect(this, &MainWidget::update_friend_icons_signal, this, &MainWidget::update_friend_icons);
-	connect(this, &MainWidget::play_sfx_signal, this, &MainWidget::play_sfx);
-	connect(this, &MainWidget::alert_signal, this, &MainWidget::create_alert);
+	connect(this, &MainWidget::ui_flush_requested_signal, this, &MainWidget::schedule_ui_flush);
 
 	// Set up signals for login/registration messages.
 	connect(&login_window, &LoginWindow::login_requested, this, &MainWidget::send_login_info);
@@ -41,8 +50,11 @@ MainWidget::MainWidget(QWidget *parent) : QStackedWidget(parent),
 	connect(this, &MainWidget::registration_successful_signal, this, &MainWidget::registration_successful_handler);
 	connect(this, &MainWidget::registration_failed_signal, this, &MainWidget::registration_failed_handler);
 
-	// Set up the signal for disconnection.
+	// Set up the signals for losing, getting back and giving up on the connection.
 	connect(this, &MainWidget::disconnected_signal, this, &MainWidget::disconnection_handler);
+	connect(this, &MainWidget::connection_lost_signal, this, &MainWidget::connection_lost_handler);
+	connect(this, &MainWidget::connected_signal, this, &MainWidget::connection_established_handler);
+	connect(this, &MainWidget::rtt_measured_signal, this, &MainWidget::rtt_measured_handler);
 
 	// Set up signals that come from the chat window.
 	connect(&chat_window, &ChatWindow::friendship_request_sent, this, &MainWidget::friend_request_handler);
@@ -52,7 +64,25 @@ MainWidget::MainWidget(QWidget *parent) : QStackedWidget(parent),
 	connect(&chat_window, &ChatWindow::friend_removal_requested, this, &MainWidget::friend_deletion_handler);
 	connect(&chat_window, &ChatWindow::messages_requested, this, &MainWidget::request_messages);
 
-	// Attempt connecting to the server.
+	// Incoming frames are parsed on the connection's I/O thread and handed over to the message processor thread.
+	connection_manager.set_frames_received_handler([this](std::vector<std::string>& frames) { parse_and_queue_frames(frames); });
+	connection_manager.set_connection_lost_handler([this] { emit connection_lost_signal(); });
+	connection_manager.set_connected_handler([this] { emit connected_signal(); });
+	connection_manager.set_disconnection_handler([this] { emit disconnected_signal(); });
+	connection_manager.set_endpoints(client_config.server_endpoints);
+	connection_manager.set_reconnect_policy(std::chrono::milliseconds(client_config.reconnect_initial_delay_ms),
+		std::chrono::milliseconds(client_config.reconnect_max_delay_ms), client_config.reconnect_max_attempts);
+	connection_manager.set_tls_session_file(client_config.tls_session_file);
+	connection_manager.set_socket_options(client_config.tcp_nodelay, client_config.tcp_keepalive);
+	connection_manager.set_rtt_handler([this](int rtt_in_milliseconds) { emit rtt_measured_signal(rtt_in_milliseconds); });
+
+	// The heartbeat asks for the statuses of no friends, which the server answers right away and changes nothing. The answer is told apart by its place among the statuses responses.
+	connection_manager.set_heartbeat([this] { return send_status_request(new_request("get-statuses").field("friends", std::vector<std::string>()).finish(), true); },
+		std::chrono::seconds(client_config.heartbeat_interval_seconds), std::chrono::seconds(client_config.dead_link_timeout_seconds));
+
+	login_window.installEventFilter(this);
+
+	// Start connecting to the server, the login window is shown and usable in the meantime.
 	try {
 		connection_manager.connect();
 	}
@@ -62,14 +92,24 @@ MainWidget::MainWidget(QWidget *parent) : QStackedWidget(parent),
 		if (pressed_button == QMessageBox::Ok) // Exit the app after the "OK" button is clicked.
 			exit(EXIT_FAILURE);
 	}
+}
+
+bool MainWidget::eventFilter(QObject* watched, QEvent* event) {
+	if (watched == &login_window && event->type() == QEvent::Paint) {
+		Globals::startup::mark("first paint");
+		login_window.removeEventFilter(this);
+	}
 
-	network_thread.detach();
-	message_processor_thread.detach();
-	friend_status_checker_thread.detach();
+	return QStackedWidget::eventFilter(watched, event);
 }
 
 MainWidget::~MainWidget()
 {
+	connection_manager.shutdown(); // Stop the I/O thread before the members its handlers use are destroyed.
+
+	received_messages.close();
+	message_processor_thread.join();
+	history_decoder.join();
 }
 
 QSize MainWidget::sizeHint() const {
@@ -90,289 +130,365 @@ void MainWidget::setCurrentIndex(int index) {
 	this->adjustSize(); // Resize the QStackedWidget based on the current widget.
 }
 
-void MainWidget::receive_and_parse_forever() {
-	while (true) {
-		using json = nlohmann::json;
+void MainWidget::parse_and_queue_frames(std::vector<std::string>& frames) {
+	decoded_frames.clear();
 
-		std::string received = connection_manager.receive(); // This blocks until something can be read.
+	for (auto&& received : frames) {
+		ServerMessage message;
+		std::string error;
 
-		if (received == "DISCONNECTED") {
-			emit disconnected_signal();
-			break;
+		if (decode_server_message(received, message, error)) {
+			if (std::holds_alternative<StatusesResponse>(message) && take_status_request()) { // Nothing to process in the heartbeat's answer.
+				connection_manager.heartbeat_answered();
+				continue;
+			}
+
+			decoded_frames.emplace_back(std::move(message));
+		}
+		else { // In the unlikely event of an unparsable message, we will just log it and ignore it.
+			std::cerr << "--- RECEIVED UNPARSABLE MESSAGE: " << received << " (" << error << ") ---" << "\n";
 		}
-		else if (received == "NOT_CONNECTED")
-			continue;
+	}
 
-		std::cout << received << "\n"; // TODO - just for testing, remove later
-		json parsed;
+	// Hand the whole batch over at once so the processor thread sees messages in the order they arrived.
+	received_messages.push_batch(decoded_frames);
+}
+
+void MainWidget::process_received_forever() {
+	std::vector<ServerMessage> batch;
 
-		try {
-			parsed = json::parse(received);
+	// Sleeps until the I/O thread queues something, then handles everything that arrived in the meantime without holding the lock.
+	while (received_messages.wait_and_drain(batch)) {
+		for (auto&& received_message : batch) {
+			process_received_message(received_message);
 		}
-		catch (json::exception& e) { // In the unlikely event of an unparsable message, we will just log it and ignore it.
-			std::cerr << "--- RECEIVED UNPARSABLE MESSAGE: " << received << " ---";
-			continue;
+	}
+}
+
+void MainWidget::process_received_message(ServerMessage& received_message) {
+	using ReceivedMessageHandlers = MessageHandlerTable<
+		&MainWidget::unexpected_error_received,
+		&MainWidget::login_authentication_received,
+		&MainWidget::registration_confirmation_received,
+		&MainWidget::friend_request_result_received,
+		&MainWidget::send_message_result_received,
+		&MainWidget::new_message_received,
+		&MainWidget::new_friendship_request_received,
+		&MainWidget::friendship_request_update_received,
+		&MainWidget::friend_deletion_update_received,
+		&MainWidget::deleted_by_friend_received,
+		&MainWidget::forced_logout_received,
+		&MainWidget::fetch_messages_response_received,
+		&MainWidget::dummy_message_received,
+		&MainWidget::status_response_received,
+		&MainWidget::statuses_response_received
+	>;
+
+	if (!ReceivedMessageHandlers::dispatch(*this, received_message)) {
+		std::cerr << "--- NO HANDLER FOR RECEIVED MESSAGE TYPE: " << received_message.index() << " ---" << "\n";
+	}
+}
+
+void MainWidget::unexpected_error_received(ErrorMessage& message) {
+	std::cerr << "------- RECEIVED UNKNOWN ERROR, SERVER RECEIVED: " << message.received_type << " --------" << "\n";
+}
+
+void MainWidget::login_authentication_received(LoginAuthentication& message) {
+	if (message.success) {
+		connection_manager.has_logged_in = true;
+		connection_manager.session_cookie = std::move(message.cookie);
+
+		emit login_successful_signal(std::make_shared<const LoginAuthentication>(std::move(message)));
+	}
+	else {
+		QString failure_reason = QString::fromStdString(message.failure_reason);
+
+		emit login_failed_signal(failure_reason);
+	}
+}
+
+void MainWidget::registration_confirmation_received(RegistrationConfirmation& message) {
+	if (message.success) {
+		emit registration_successful_signal();
+	}
+	else {
+		QString failure_reason = QString::fromStdString(message.failure_reason);
+
+		emit registration_failed_signal(failure_reason);
+	}
+}
+
+void MainWidget::friend_request_result_received(FriendRequestResult& message) {
+	if (message.success) {
+		emit sig_show_popup_message(QString("Friendship request sent successfully."), QString("Success!"), QMessageBox::Information);
+	}
+	else {
+		QString failure_reason = QString::fromStdString(message.reason);
+		emit sig_show_popup_message(failure_reason, QString("Error!"));
+	}
+}
+
+void MainWidget::send_message_result_received(SendMessageResult& message) {
+	std::pair<QString, uint64_t> sent_message;
+
+	{
+		std::lock_guard<std::mutex> lock(sent_messages_mutex);
+
+		if (!unanswered_sent_messages.empty()) {
+			sent_message = std::move(unanswered_sent_messages.front());
+			unanswered_sent_messages.pop_front();
 		}
+	}
 
-		mutex.lock();
-		received_messages.emplace_back(parsed);
-		mutex.unlock();
+	if (!message.success) {
+		QString failure_reason = QString::fromStdString(message.reason);
+		emit sig_show_popup_message(failure_reason);
 	}
+
+	if (sent_message.second == 0)
+		return;
+
+	queue_ui_update([this, sent_message, is_sent = message.success] {
+		if (is_sent)
+			chat_window.sent_message_confirmed(sent_message.first, sent_message.second);
+		else
+			chat_window.remove_sent_message(sent_message.first, sent_message.second);
+	});
 }
 
-void MainWidget::process_received_forever() {
-	while (true) {
-		if (!received_messages.empty()) {
-			mutex.lock();
+void MainWidget::new_message_received(NewMessage& message) {
+	uint32_t sent_by_id = UsernameTable::instance().intern_utf8(message.sent_by);
+	QString sent_by = UsernameTable::instance().name(sent_by_id); // Shares the interned string instead of converting it again.
+
+	queue_ui_update([this, sent_by, stored_message = StoredMessage{ message.sent_at, sent_by_id, std::move(message.message_content) }]() mutable {
+		QListWidgetItem* friend_item = chat_window.get_friend_qlistwidgetitem_object_by_name(sent_by);
 
-			nlohmann::json received_json = received_messages[0];
+		if (friend_item == nullptr)
+			return;
+
+		bool is_appended = false;
+
+		if (history_pages_in_flight.count(sent_by) != 0) // Goes in right after the history that is still being decoded.
+			messages_waiting_for_history[sent_by].push_back(std::move(stored_message));
+		else
+			is_appended = chat_window.append_message(sent_by, std::move(stored_message)); // Only appended if the history is loaded.
+
+		if (is_appended && friend_item == chat_window.get_currently_selected_friend()) {
+			request_chatbox_refresh(true);
+		}
+		else {
+			chat_window.change_friend_colour(sent_by, Qt::red);
+		}
+
+		request_sfx(SoundEffect::NEW_MESSAGE);
+		request_alert(3000);
+	});
+}
+
+void MainWidget::new_friendship_request_received(NewFriendshipRequest& message) {
+	queue_ui_update([this, sender_name = QString::fromStdString(message.sent_by)] {
+		chat_window.add_new_friend_request(sender_name);
+		request_sfx(SoundEffect::NEW_FRIEND_REQUEST);
+		request_alert(5000);
+	});
+}
+
+void MainWidget::friendship_request_update_received(FriendshipRequestUpdate& message) {
+	if (message.is_accepted) {
+		queue_ui_update([this, request_recipient = QString::fromStdString(message.request_recipient)] {
+			chat_window.add_new_friend(request_recipient);
+			request_friend_status(request_recipient);
+		});
+	}
+	else {
+		QString popup_window_text = QString::fromStdString(message.request_recipient) + " denied your friend request.";
+
+		emit sig_show_popup_message(popup_window_text, "Friend request update", QMessageBox::Information, ":(");
+	}
+}
+
+void MainWidget::friend_deletion_update_received(FriendDeletionUpdate& message) {
+	if (!message.success) {
+		QString error = QString::fromStdString(message.reason);
+		QString popup_window_text = "Can't delete '" + QString::fromStdString(message.deleted_user) + "', error: " + error;
+
+		emit sig_show_popup_message(popup_window_text);
+	}
+	else {
+		queue_ui_update([this, deleted_friend = message.deleted_user] {
+			chat_window.remove_from_friends_list(QString::fromStdString(deleted_friend));
+			presence_tracker.forget(deleted_friend);
+			request_sfx(SoundEffect::FRIEND_DELETED);
+		});
+	}
+}
+
+void MainWidget::deleted_by_friend_received(DeletedByFriend& message) {
+	queue_ui_update([this, deleted_by = message.deleted_by] {
+		chat_window.remove_from_friends_list(QString::fromStdString(deleted_by));
+		presence_tracker.forget(deleted_by);
+	});
+}
 
-			ReceivedMessageType received_message_type = received_string_to_enum[received_json["message-type"]];
+void MainWidget::forced_logout_received(ForcedLogout& message) {
+	emit forced_logout_signal(QString::fromStdString(message.reason));
+}
+
+void MainWidget::fetch_messages_response_received(FetchMessagesResponse& message) {
+	QString friend_name = QString::fromStdString(message.user);
+	int max_index = take_history_request(friend_name);
+
+	if (!message.success) {
+		QString reason = QString::fromStdString(message.reason);
+
+		queue_ui_update([this, friend_name] { chat_window.history_page_failed(friend_name); });
+		emit sig_show_popup_message("Error while getting message history with " + friend_name + ", error: " + reason);
+	}
+	else {
+		// Queued before the page is handed to the decoder, so every new message processed after this one waits for the page.
+		queue_ui_update([this, friend_name] { history_pages_in_flight[friend_name]++; });
+		history_decoder.submit(friend_name, max_index, std::move(message.messages));
+	}
+}
+
+int MainWidget::take_history_request(const QString& friend_username) {
+	std::lock_guard<std::mutex> lock(history_requests_mutex);
+	auto requests = unanswered_history_requests.find(friend_username);
+
+	if (requests == unanswered_history_requests.end() || requests->second.empty())
+		return ChatWindow::history_page_size; // Not something we asked for, so treat it like the newest page.
+
+	int max_index = requests->second.front();
+	requests->second.pop_front();
+
+	if (requests->second.empty())
+		unanswered_history_requests.erase(requests);
 
-			switch (received_message_type) {
-				case ReceivedMessageType::ERROR_MESSAGE: {
-					std::string server_received_type = received_json["received-type"];
-					std::cerr << "------- RECEIVED UNKNOWN ERROR, SERVER RECEIVED: " << server_received_type << " --------" << "\n";
-					break;
-				}
+	return max_index;
+}
+
+SendResult MainWidget::send_status_request(std::string request, bool is_heartbeat_probe) {
+	std::lock_guard<std::mutex> lock(status_requests_mutex); // Held while sending, so the requests are recorded in the order they're written.
+	SendResult result = connection_manager.send(std::move(request));
+
+	if (result == SendResult::QUEUED)
+		unanswered_status_requests.push_back(is_heartbeat_probe);
+
+	return result;
+}
+
+bool MainWidget::take_status_request() {
+	std::lock_guard<std::mutex> lock(status_requests_mutex);
 
-				case ReceivedMessageType::LOGIN_AUTHENTICATION: {
-					bool is_successful = received_json["success"];
+	if (unanswered_status_requests.empty()) // Not something we asked for, so not the heartbeat's either.
+		return false;
 
-					if (is_successful) {
-						connection_manager.has_logged_in = true;
-						connection_manager.session_cookie = received_json["cookie"];
-						std::vector<std::string> friends = received_json["friends"].get<std::vector<std::string>>();
-						std::vector<std::string> friend_requests = received_json["friend-requests"].get<std::vector<std::string>>();
+	bool is_heartbeat_probe = unanswered_status_requests.front();
+	unanswered_status_requests.pop_front();
 
-						emit play_sfx_signal(SoundEffect::LOGIN_SUCCESSFUL);
-						emit login_successful_signal(friends, friend_requests);
-					}
-					else {
-						QString failure_reason = QString::fromStdString(received_json["failure-reason"]);
+	return is_heartbeat_probe;
+}
+
+void MainWidget::forget_status_requests() {
+	std::lock_guard<std::mutex> lock(status_requests_mutex);
+	unanswered_status_requests.clear();
+}
 
-						emit login_failed_signal(failure_reason);
-					}
+void MainWidget::history_page_decoded(DecodedHistoryPage& page) {
+	chat_window.add_history_page(page.friend_username, page.max_index, page.oldest_first_messages);
 
-					break;
-				}
+	auto in_flight = history_pages_in_flight.find(page.friend_username);
+	bool has_appended_messages = false;
 
-				case ReceivedMessageType::REGISTRATION_CONFIRMATION: {
-					bool is_successful = received_json["success"];
+	if (in_flight != history_pages_in_flight.end() && --in_flight->second == 0) {
+		history_pages_in_flight.erase(in_flight);
 
-					if (is_successful) {
-						emit registration_successful_signal();
-					}
-					else {
-						QString failure_reason = QString::fromStdString(received_json["failure-reason"]);
-
-						emit registration_failed_signal(failure_reason);
-					}
-
-					break;
-				}
-
-				case ReceivedMessageType::FRIEND_REQUEST_RESULT: {
-					bool is_successful = received_json["success"];
-
-					if (is_successful) {
-						emit sig_show_popup_message(QString("Friendship request sent successfully."), QString("Success!"), QMessageBox::Information);
-					}
-					else {
-						QString failure_reason = QString::fromStdString(received_json["reason"]);
-						emit sig_show_popup_message(failure_reason, QString("Error!"));
-					}
-
-					break;
-				}
-
-				case ReceivedMessageType::SEND_MESSAGE_RESULT: {
-					bool is_successful = received_json["success"];
-
-					if (!is_successful) {
-						QString failure_reason = QString::fromStdString(received_json["reason"]);
-						emit sig_show_popup_message(failure_reason);
-					}
-
-					break;
-				}
-
-				case ReceivedMessageType::NEW_MESSAGE: {
-					unsigned long long sent_at_ulonglong = received_json["sent-at"];
-
-					QString sent_by = QString::fromStdString(received_json["sent-by"]);
-					QString sent_at = QString::fromStdString(Globals::time::unix_time_to_readable_string(sent_at_ulonglong));
-					QString message_content = QString::fromStdString(received_json["message-content"]);
-
-					QString finalized_str = sent_at + " " + sent_by + ": " + message_content;
-
-					QListWidgetItem* friend_item = chat_window.get_friend_qlistwidgetitem_object_by_name(sent_by);
-
-					if (friend_item != nullptr) {
-						QVariant friend_data = friend_item->data(Qt::UserRole);
-
-						if (!friend_data.isNull()) { // Check if friend data is loaded from the server.
-							QList<QVariant> friend_data_qlist = friend_data.toList();
-
-							friend_data_qlist.insert(friend_data_qlist.begin(), finalized_str); // Newest messages are at the start of the vector.
-							friend_item->setData(Qt::UserRole, friend_data_qlist);
-
-							if (sent_by == chat_window.get_currently_selected_friend()->text()) {
-								emit update_chatbox_signal(true);
-							}
-							else {
-								chat_window.change_friend_colour(sent_by, Qt::red);
-							}
-						}
-						else {
-							chat_window.change_friend_colour(sent_by, Qt::red);
-						}
-
-						emit play_sfx_signal(SoundEffect::NEW_MESSAGE);
-						emit alert_signal(3000);
-					}
-
-					break;
-				}
-
-				case ReceivedMessageType::NEW_FRIENDSHIP_REQUEST: {
-					std::string sender = received_json["sent-by"];
-
-					chat_window.add_new_friend_request(QString::fromStdString(sender));
-					emit play_sfx_signal(SoundEffect::NEW_FRIEND_REQUEST);
-					emit alert_signal(5000);
-
-					break;
-				}
-
-				case ReceivedMessageType::FRIENDSHIP_REQUEST_UPDATE: {
-					std::string request_recipient = received_json["request-recipient"];
-					bool is_accepted = received_json["is_accepted"];
-
-					if (is_accepted) {
-						chat_window.add_new_friend(QString::fromStdString(request_recipient));
-					}
-					else {
-						QString popup_window_text = QString::fromStdString(request_recipient) + " denied your friend request.";
-
-						emit sig_show_popup_message(popup_window_text, "Friend request update", QMessageBox::Information, ":(");
-					}
-					break;
-				}
-																   
-				case ReceivedMessageType::FRIEND_DELETION_UPDATE: {
-					std::string deleted_friend = received_json["deleted-user"];
-					bool is_successful = received_json["success"];
-
-					if (!is_successful) {
-						QString error = QString::fromStdString(received_json["reason"]);
-						QString popup_window_text = "Can't delete '" + QString::fromStdString(deleted_friend) + "', error: " + error;
-
-						emit sig_show_popup_message(popup_window_text);
-					}
-					else {
-						chat_window.remove_from_friends_list(QString::fromStdString(deleted_friend));
-						emit play_sfx_signal(SoundEffect::FRIEND_DELETED);
-					}
-					break;
-				}
-
-				case ReceivedMessageType::DELETED_BY_FRIEND: {
-					std::string deleted_by = received_json["deleted-by"];
-
-					chat_window.remove_from_friends_list(QString::fromStdString(deleted_by));
-					break;
-				}
-
-				case ReceivedMessageType::FORCED_LOGOUT: {
-					std::string reason = received_json["reason"];
-
-					emit forced_logout_signal(QString::fromStdString(reason));
-					break;
-				}
-
-				case ReceivedMessageType::FETCH_MESSAGES_REQUEST_RESPONSE: {
-					bool is_successful = received_json["success"];
-
-					if (!is_successful) {
-						QString reason = QString::fromStdString(received_json["reason"]);
-						QString user = QString::fromStdString(received_json["user"]);
-
-						emit sig_show_popup_message("Error while getting message history with " + user + ", error: " + reason);
-					}
-					else {
-						try {
-							QString friend_name = QString::fromStdString(received_json["user"]);
-							std::vector<std::string> message_json_vector = received_json["messages"].get<std::vector<std::string>>();
-							QList<QVariant> message_json_qlist;
-
-							for (auto&& message_json : message_json_vector) {
-								nlohmann::json json = nlohmann::json::parse(message_json);
-
-								unsigned long long sent_at_ulonglong = json["sent-at"];
-
-								QString sent_by = QString::fromStdString(json["sent-by"]);
-								QString message_content = QString::fromStdString(json["message-content"]);
-								QString sent_at = QString::fromStdString(Globals::time::unix_time_to_readable_string(sent_at_ulonglong));
-
-								QString finalized_qstr = Globals::generate_message(sent_at, sent_by, message_content);
-								message_json_qlist.append(finalized_qstr);
-							}
-
-							chat_window.set_friend_data(friend_name, message_json_qlist);
-
-
-							if (chat_window.get_currently_selected_friend()->text() == friend_name) {
-								emit update_chatbox_signal(false);
-							}
-						}
-						catch (const std::exception& e) {
-							std::cout << e.what() << "\n";
-						}
-						catch (...) {
-							std::cout << "--- Non std::exception caught ---" << "\n";
-						}
-					}
-					break;
-				}
-
-				case ReceivedMessageType::DUMMY_MESSAGE:
-					break;
-
-				case ReceivedMessageType::GET_STATUSES_RESPONSE: {
-					nlohmann::json friend_statuses = received_json["is_friend_online"];
-					emit update_friend_icons_signal(friend_statuses);
-
-					break;
-				}
-
-				default: {
-					std::cerr << "--- RECEIVED UNRECOGNIZED MESSAGE TYPE: " << received_json["message-type"] << " ---" << "\n";
-				}
+		auto waiting = messages_waiting_for_history.find(page.friend_username);
+
+		if (waiting != messages_waiting_for_history.end()) {
+			for (auto&& stored_message : waiting->second) {
+				has_appended_messages |= chat_window.append_message(page.friend_username, std::move(stored_message));
 			}
 
-			received_messages.erase(received_messages.begin()); // Remove the message from the vector after we're done with it.
-			mutex.unlock();
+			messages_waiting_for_history.erase(waiting);
 		}
 	}
+
+	QListWidgetItem* selected_friend = chat_window.get_currently_selected_friend();
+
+	if (selected_friend != nullptr && selected_friend->text() == page.friend_username) {
+		if (page.max_index <= ChatWindow::history_page_size) // The newest page, older pages are inserted above what's shown without moving the view.
+			request_chatbox_refresh(false);
+		else if (has_appended_messages)
+			request_chatbox_refresh(true);
+	}
+}
+
+void MainWidget::status_response_received(StatusResponse& message) {
+	queue_ui_update([this, friend_username = message.friend_username, is_online = message.is_online] {
+		if (presence_tracker.apply(friend_username, is_online))
+			chat_window.update_friend_icon(QString::fromStdString(friend_username), is_online);
+	});
+}
+
+void MainWidget::statuses_response_received(StatusesResponse& message) {
+	queue_ui_update([this, friend_statuses = std::move(message.is_friend_online)] {
+		update_friend_icons(friend_statuses);
+	});
+}
+
+void MainWidget::dummy_message_received(DummyMessage&) {
+	// Nothing to do, like everything that arrives it already counted as a sign of life in ConnectionManager.
+}
+
+void MainWidget::send_when_connected(std::string message) {
+	if (connection_manager.has_connected) {
+		send_to_server(std::move(message));
+		return;
+	}
+
+	request_waiting_for_connection = std::move(message);
+	login_window.show_connection_status("Not connected yet, your request will be sent once the connection is up.");
+}
+
+RequestWriter MainWidget::new_request(std::string_view message_type) {
+	return RequestWriter(connection_manager.acquire_buffer(), message_type);
 }
 
-void MainWidget::check_friend_statuses_forever() {
-	std::this_thread::sleep_for(std::chrono::seconds(60));
+bool MainWidget::send_to_server(std::string message) {
+	return report_send_result(connection_manager.send(std::move(message)));
+}
 
-	if (connection_manager.has_logged_in) {
-		request_friend_statuses();
+bool MainWidget::report_send_result(SendResult result) {
+	if (result == SendResult::QUEUE_FULL) {
+		emit sig_show_popup_message("Too many requests are waiting to be sent to the server. Please slow down and try again.");
 	}
+
+	return result == SendResult::QUEUED;
 }
 
 void MainWidget::swap_to_register_window() {
 	setCurrentIndex(REGISTER_WINDOW);
-	setWindowTitle("Konkon - Register");
+	update_window_title();
 }
 
 void MainWidget::swap_to_login_window() {
 	setCurrentIndex(LOGIN_WINDOW);
-	setWindowTitle("Konkon - Login");
+	update_window_title();
+}
+
+void MainWidget::update_window_title() {
+	QString title = "Konkon - Login";
+
+	if (currentIndex() == REGISTER_WINDOW)
+		title = "Konkon - Register";
+	else if (currentIndex() == CHAT_WINDOW)
+		title = "Konkon - " + QString::fromStdString(connection_manager.username);
+
+	if (is_reconnecting)
+		title += " (reconnecting...)";
+
+	setWindowTitle(title);
 }
 
 void MainWidget::slot_show_popup_message(QString message, QString title, QMessageBox::Icon icon, QString custom_button_text) {
@@ -382,35 +498,60 @@ void MainWidget::slot_show_popup_message(QString message, QString title, QMessag
 void MainWidget::send_login_info(QString username, QString password) {
 	chat_window.username = username;
 	connection_manager.username = username.toStdString();
+	session_password = password;
 
-	nlohmann::json json_obj;
-	json_obj["message-type"] = "login-request";
-	json_obj["username"] = username.toStdString();
-	json_obj["password"] = password.toStdString();
-
-	std::string serialized_data = json_obj.dump();
-	connection_manager.send(serialized_data);
+	send_when_connected(new_request("login-request")
+		.field("username", username)
+		.field("password", password)
+		.finish());
 }
 
 void MainWidget::send_registration_info(QString username, QString password) {
-	nlohmann::json json_obj;
-	json_obj["message-type"] = "registration-request";
-	json_obj["username"] = username.toStdString();
-	json_obj["password"] = password.toStdString();
-
-	std::string serialized_data = json_obj.dump();
-	connection_manager.send(serialized_data);
+	send_when_connected(new_request("registration-request")
+		.field("username", username)
+		.field("password", password)
+		.finish());
 }
 
-void MainWidget::login_successful_handler(std::vector<std::string> friends, std::vector<std::string> friend_requests) {
+void MainWidget::login_successful_handler(LoginSnapshot login) {
+	if (is_resuming_session) {
+		resume_session(login);
+		return;
+	}
+
+	play_sfx(SoundEffect::LOGIN_SUCCESSFUL);
+	Globals::startup::mark("logged in");
+	forget_status_requests(); // Requests of an earlier session that were never answered.
+	connection_manager.set_heartbeat_active(true);
+
 	chat_window.reset();
-	chat_window.setup(friends, friend_requests);
+	chat_window.setup(login->friends, login->friend_requests);
 	setCurrentIndex(CHAT_WINDOW);
-	setWindowTitle("Konkon - " + QString::fromStdString(connection_manager.username));
+	update_window_title();
+
+	{
+		std::lock_guard<std::mutex> lock(history_requests_mutex);
+		unanswered_history_requests.clear(); // Requests of an earlier session that were never answered.
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(sent_messages_mutex);
+		unanswered_sent_messages.clear();
+	}
+
+	presence_tracker.clear();
 	request_friend_statuses();
+	presence_resync_timer.start();
 }
 
 void MainWidget::login_failed_handler(QString reason) {
+	if (is_resuming_session) {
+		is_resuming_session = false;
+		forced_logout_handler("Could not log back in after reconnecting to the server: " + reason);
+		return;
+	}
+
+	session_password.clear();
 	Globals::UI::show_popup_window(reason);
 }
 
@@ -423,108 +564,204 @@ void MainWidget::registration_failed_handler(QString reason) {
 }
 
 void MainWidget::exit_handler() {
-	nlohmann::json json_obj;
-	json_obj["message-type"] = "disconnection-notification";
-	json_obj["username"] = connection_manager.username;
+	std::string serialized_data = new_request("disconnection-notification")
+		.field("username", connection_manager.username)
+		.finish();
+
+	connection_manager.send(std::move(serialized_data)); // No point in warning the user about a full queue while exiting.
+}
+
+void MainWidget::connection_lost_handler() {
+	is_reconnecting = true;
+	is_resuming_session = false; // A login sent on a connection that dropped again will never be answered.
+	presence_resync_timer.stop();
+	update_window_title();
+	login_window.show_connection_status("Connection lost, reconnecting...");
+	chat_window.show_connection_status("lost, reconnecting...");
+}
 
-	std::string serialized_data = json_obj.dump();
-	connection_manager.send(serialized_data);
+void MainWidget::connection_established_handler() {
+	is_reconnecting = false;
+	update_window_title();
+	login_window.show_connection_status("Connected.");
+	chat_window.show_connection_status("connected");
+	Globals::startup::mark("connected");
+
+	if (!request_waiting_for_connection.empty())
+		send_to_server(std::move(request_waiting_for_connection));
+
+	request_waiting_for_connection.clear(); // Moved-from strings aren't guaranteed to be empty.
+
+	if (!connection_manager.has_logged_in || session_password.isEmpty())
+		return;
+
+	// The server forgets the session along with the connection, so log in again and resume it when the answer comes.
+	is_resuming_session = true;
+
+	send_to_server(new_request("login-request")
+		.field("username", connection_manager.username)
+		.field("password", session_password)
+		.finish());
+}
+
+void MainWidget::rtt_measured_handler(int rtt_in_milliseconds) {
+	chat_window.update_connection_quality(rtt_in_milliseconds);
+}
+
+void MainWidget::resume_session(const LoginSnapshot& login) {
+	is_resuming_session = false;
+	forget_status_requests(); // Lost with the old connection, like the requests below.
+	connection_manager.set_heartbeat_active(true);
+
+	{
+		// Responses to these were lost with the old connection. Cleared only now, since the processor thread handled every frame that came before the login response.
+		std::lock_guard<std::mutex> lock(history_requests_mutex);
+		unanswered_history_requests.clear();
+	}
+
+	std::deque<std::pair<QString, uint64_t>> lost_sent_messages;
+
+	{
+		std::lock_guard<std::mutex> lock(sent_messages_mutex);
+		lost_sent_messages.swap(unanswered_sent_messages);
+	}
+
+	// Whether these got to the server is unknown, the pages requested below bring the server's copies of the ones that did.
+	for (auto&& [friend_username, send_id] : lost_sent_messages) {
+		chat_window.remove_sent_message(friend_username, send_id);
+	}
+
+	chat_window.resync_after_reconnect(login->friends, login->friend_requests);
+
+	presence_tracker.clear();
+	request_friend_statuses();
+	presence_resync_timer.start();
 }
 
 void MainWidget::disconnection_handler() {
-	int pressed = Globals::UI::show_popup_window("Lost connection to the server. Please check your internet connection and try connecting again.");
+	int pressed = Globals::UI::show_popup_window("Couldn't connect to the server. Please check your internet connection and try connecting again.");
 
 	if (pressed == QMessageBox::Ok)
 		exit(EXIT_FAILURE);
 }
 
 void MainWidget::friend_request_handler(QString request_target) {
-	if (request_target == QString::fromStdString(connection_manager.username)) {
+	if (request_target == chat_window.username) {
 		Globals::UI::show_popup_window("You can't send a friendship request to yourself...");
 	}
 	else {
-		nlohmann::json json_obj;
-		json_obj["message-type"] = "friend-request";
-		json_obj["from"] = connection_manager.username;
-		json_obj["to"] = request_target.toStdString();
-		json_obj["cookie"] = connection_manager.session_cookie;
-
-		std::string serialized_data = json_obj.dump();
-		connection_manager.send(serialized_data);
+		send_to_server(new_request("friend-request")
+			.field("from", connection_manager.username)
+			.field("to", request_target)
+			.field("cookie", connection_manager.session_cookie)
+			.finish());
 	}
 }
 
 void MainWidget::friend_request_response_handler(bool is_accepted, QString request_sender) {
-	nlohmann::json json_obj;
-	json_obj["message-type"] = "friend-request-response";
-	json_obj["accepted"] = is_accepted;
-	json_obj["request_sender"] = request_sender.toStdString();
-	json_obj["request_replier"] = connection_manager.username;
-	json_obj["cookie"] = connection_manager.session_cookie;
-
-	std::string serialized_data = json_obj.dump();
-	connection_manager.send(serialized_data);
+	send_to_server(new_request("friend-request-response")
+		.field("accepted", is_accepted)
+		.field("request_sender", request_sender)
+		.field("request_replier", connection_manager.username)
+		.field("cookie", connection_manager.session_cookie)
+		.finish());
+
+	if (is_accepted)
+		request_friend_status(request_sender);
 }
 
 void MainWidget::sent_message_handler(QString message_content, QString message_target) {
-	nlohmann::json json_obj;
-	json_obj["message-type"] = "send-message";
-	json_obj["from"] = connection_manager.username;
-	json_obj["to"] = message_target.toStdString();
-	json_obj["cookie"] = connection_manager.session_cookie;
-	json_obj["message-content"] = message_content.toStdString();
+	std::string serialized_data = new_request("send-message")
+		.field("from", connection_manager.username)
+		.field("to", message_target)
+		.field("cookie", connection_manager.session_cookie)
+		.field("message-content", message_content)
+		.finish();
+
+	SendResult result;
+
+	{
+		std::lock_guard<std::mutex> lock(sent_messages_mutex); // Held while sending, so the result can't be processed before it's expected.
+		result = connection_manager.send(std::move(serialized_data));
+
+		if (result == SendResult::QUEUED)
+			unanswered_sent_messages.emplace_back(message_target, chat_window.add_sent_message(message_target, message_content));
+	}
+
+	bool is_sent = report_send_result(result); // The popup is modal, so not while holding the lock.
 
-	std::string serialized_data = json_obj.dump();
-	connection_manager.send(serialized_data);
+	if (!is_sent && is_reconnecting)
+		Globals::UI::show_popup_window("Reconnecting to the server, your message wasn't sent. Please try again in a moment.");
 }
 
 void MainWidget::friend_deletion_handler(QString username) {
-	nlohmann::json json_obj;
-	json_obj["message-type"] = "friend-deletion-request";
-	json_obj["username"] = connection_manager.username;
-	json_obj["cookie"] = connection_manager.session_cookie;
-	json_obj["deleted-person"] = username.toStdString();
-	
-	std::string serialized_data = json_obj.dump();
-	connection_manager.send(serialized_data);
+	send_to_server(new_request("friend-deletion-request")
+		.field("username", connection_manager.username)
+		.field("cookie", connection_manager.session_cookie)
+		.field("deleted-person", username)
+		.finish());
 }
 
 void MainWidget::logout_handler() {
-	nlohmann::json json_obj;
-	json_obj["message-type"] = "logout-notification";
-	json_obj["username"] = connection_manager.username;
-
-	std::string serialized_data = json_obj.dump();
-	connection_manager.send(serialized_data);
+	send_to_server(new_request("logout-notification")
+		.field("username", connection_manager.username)
+		.finish());
 
 	connection_manager.reset_info();
+	connection_manager.set_heartbeat_active(false);
+	session_password.clear();
 	chat_window.reset();
+	presence_resync_timer.stop();
+	presence_tracker.clear();
 
 	setCurrentIndex(LOGIN_WINDOW);
+	update_window_title();
 }
 
 void MainWidget::forced_logout_handler(QString reason) {
 	int response = Globals::UI::show_popup_window(reason);
 
 	connection_manager.reset_info();
+	connection_manager.set_heartbeat_active(false);
+	session_password.clear();
 	chat_window.reset();
+	presence_resync_timer.stop();
+	presence_tracker.clear();
 
 	setCurrentIndex(LOGIN_WINDOW);
+	update_window_title();
 }
 
 void MainWidget::request_messages(QString friend_username, int max_index) {
-	nlohmann::json json_obj;
-	json_obj["message-type"] = "fetch-messages-request";
-	json_obj["requester"] = connection_manager.username;
-	json_obj["cookie"] = connection_manager.session_cookie;
-	json_obj["other-participant"] = friend_username.toStdString();
-	json_obj["max_index"] = max_index;
+	std::string serialized_data = new_request("fetch-messages-request")
+		.field("requester", connection_manager.username)
+		.field("cookie", connection_manager.session_cookie)
+		.field("other-participant", friend_username)
+		.field("max_index", max_index)
+		.finish();
+
+	{
+		std::lock_guard<std::mutex> lock(history_requests_mutex);
+		unanswered_history_requests[friend_username].push_back(max_index);
+	}
+
+	if (!send_to_server(std::move(serialized_data))) {
+		{
+			std::lock_guard<std::mutex> lock(history_requests_mutex);
+			std::deque<int>& requests = unanswered_history_requests[friend_username];
+
+			if (!requests.empty())
+				requests.pop_back();
+		}
 
-	std::string serialized_data = json_obj.dump();
-	connection_manager.send(serialized_data);
+		chat_window.history_page_failed(friend_username);
+	}
 }
 
 void MainWidget::request_friend_statuses() {
+	if (!connection_manager.has_logged_in)
+		return;
+
 	QListWidget* list_widget = chat_window.get_friends_list_object();
 	std::vector<std::string> friends_vec;
 
@@ -533,21 +770,85 @@ void MainWidget::request_friend_statuses() {
 		friends_vec.push_back(item->text().toStdString());
 	}
 
-	nlohmann::json json_obj;
-	json_obj["message-type"] = "get-statuses";
-	json_obj["friends"] = friends_vec;
+	// Big friend lists are split up so that no single request or response gets huge.
+	for (auto&& batch : PresenceTracker::make_batches(friends_vec, client_config.presence_resync_batch_size)) {
+		report_send_result(send_status_request(new_request("get-statuses")
+			.field("friends", batch)
+			.finish(), false));
+	}
+}
+
+void MainWidget::request_friend_status(QString friend_username) {
+	send_to_server(new_request("get-status")
+		.field("friend-username", friend_username)
+		.finish());
+}
+
+void MainWidget::queue_ui_update(std::function<void()> update) {
+	{
+		std::lock_guard<std::mutex> lock(ui_update_mutex);
+		pending_ui_updates.emplace_back(std::move(update));
+	}
+
+	if (!ui_flush_scheduled.exchange(true))
+		emit ui_flush_requested_signal();
+}
+
+void MainWidget::schedule_ui_flush() {
+	if (!ui_flush_timer.isActive())
+		ui_flush_timer.start();
+}
+
+void MainWidget::flush_ui_updates() {
+	std::vector<std::function<void()>> updates;
+
+	{
+		std::lock_guard<std::mutex> lock(ui_update_mutex);
+		updates.swap(pending_ui_updates);
+		ui_flush_scheduled = false; // Anything queued from now on needs another flush.
+	}
+
+	for (auto&& update : updates) {
+		update();
+	}
+
+	chat_window.flush_message_cache(); // Every message the updates cached is written out together.
+
+	// However many messages came in for the open conversation, the chatbox is only rebuilt once.
+	if (chatbox_refresh_pending) {
+		chat_window.update_chatbox(chatbox_refresh_is_for_new_message);
+		chatbox_refresh_pending = false;
+	}
+
+	// Likewise a burst of messages plays one sound and flashes the taskbar once.
+	for (SoundEffect which_sfx : sfx_to_play) {
+		play_sfx(which_sfx);
+	}
+
+	sfx_to_play.clear();
+
+	if (alert_duration_in_milliseconds > 0) {
+		create_alert(alert_duration_in_milliseconds);
+		alert_duration_in_milliseconds = 0;
+	}
+}
+
+void MainWidget::request_chatbox_refresh(bool is_for_new_message) {
+	chatbox_refresh_is_for_new_message = chatbox_refresh_pending ? (chatbox_refresh_is_for_new_message && is_for_new_message) : is_for_new_message;
+	chatbox_refresh_pending = true;
+}
 
-	std::string serialized_data = json_obj.dump();
-	connection_manager.send(serialized_data);
+void MainWidget::request_sfx(SoundEffect which_sfx) {
+	sfx_to_play.insert(which_sfx);
 }
 
-void MainWidget::update_chatbox_slot(bool is_for_new_message) {
-	chat_window.update_chatbox(is_for_new_message);
+void MainWidget::request_alert(int duration_in_milliseconds) {
+	alert_duration_in_milliseconds = std::max(alert_duration_in_milliseconds, duration_in_milliseconds);
 }
 
-void MainWidget::update_friend_icons(nlohmann::json friend_statuses) {
-	for (auto it : friend_statuses.items()) {
-		chat_window.update_friend_icon(QString::fromStdString(it.key()), it.value());
+void MainWidget::update_friend_icons(const std::vector<std::pair<std::string, bool>>& friend_statuses) {
+	for (auto&& [friend_username, is_online] : presence_tracker.apply(friend_statuses)) { // Friends whose status didn't change are left alone.
+		chat_window.update_friend_icon(QString::fromStdString(friend_username), is_online);
 	}
 }
 
@@ -4,6 +4,7 @@
 #include <QApplication>
 #include <QStackedWidget>
 #include <QList>
+#include <QTimer>
 #include <QtMultimedia/QSoundEffect>
 #include <iostream>
 #include <string>
@@ -11,6 +12,11 @@
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <deque>
+#include <set>
 #include <ctime>
 #include <iomanip>
 #include <chrono> 
@@ -20,7 +26,13 @@
 #include "registerwindow.h"
 #include "globals.h"
 #include "connectionmanager.h"
+#include "servermessages.h"
+#include "blockingqueue.h"
+#include "clientconfig.h"
+#include "presencetracker.h"
 #include "chatwindow.h"
+#include "historydecoder.h"
+#include "requestwriter.h"
 
 enum WindowEnum {
 	LOGIN_WINDOW = 0,
@@ -28,23 +40,8 @@ enum WindowEnum {
 	CHAT_WINDOW = 2
 };
 
-enum class ReceivedMessageType {
-	ERROR_MESSAGE,
-	LOGIN_AUTHENTICATION,
-	REGISTRATION_CONFIRMATION,
-	FRIEND_REQUEST_RESULT,
-	SEND_MESSAGE_RESULT,
-	NEW_MESSAGE,
-	NEW_FRIENDSHIP_REQUEST,
-	FRIENDSHIP_REQUEST_UPDATE,
-	FRIEND_DELETION_UPDATE,
-	DELETED_BY_FRIEND,
-	FORCED_LOGOUT,
-	FETCH_MESSAGES_REQUEST_RESPONSE,
-	DUMMY_MESSAGE,
-	GET_STATUS_RESPONSE,
-	GET_STATUSES_RESPONSE
-};
+// Handed to the GUI thread as one shared, immutable snapshot, so queued connections copy a pointer instead of the friend lists.
+using LoginSnapshot = std::shared_ptr<const LoginAuthentication>;
 
 enum class SoundEffect {
 	NEW_MESSAGE,
@@ -65,21 +62,23 @@ public:
 	void setCurrentIndex(int index);
 	QSize sizeHint() const override;
 	QSize minimumSizeHint() const override;
+	bool eventFilter(QObject* watched, QEvent* event) override; // Catches the login window's first paint for the startup timing.
 
-	void request_friend_statuses();
+	void request_friend_statuses(); // Fetches the status of every friend, in batches.
+	void request_friend_status(QString friend_username);
 
 signals:
-	void login_successful_signal(std::vector<std::string> friends, std::vector<std::string> friend_requests);
+	void login_successful_signal(LoginSnapshot login);
 	void login_failed_signal(QString reason);
 	void registration_successful_signal();
 	void registration_failed_signal(QString reason);
 	void disconnected_signal();
+	void connection_lost_signal();
+	void connected_signal();
+	void rtt_measured_signal(int rtt_in_milliseconds);
 	void sig_show_popup_message(QString message, QString title = "Warning!", QMessageBox::Icon icon = QMessageBox::Warning, QString custom_button_text = "OK");
 	void forced_logout_signal(QString reason);
-	void update_chatbox_signal(bool is_for_new_message);
-	void update_friend_icons_signal(nlohmann::json friend_statuses);
-	void play_sfx_signal(SoundEffect which_sfx);
-	void alert_signal(int duration_in_milliseconds);
+	void ui_flush_requested_signal();
 
 public slots:
 	void swap_to_register_window();
@@ -88,13 +87,16 @@ public slots:
 	void send_login_info(QString username, QString password);
 	void send_registration_info(QString username, QString password);
 
-	void login_successful_handler(std::vector<std::string> friends, std::vector<std::string> friend_requests);
+	void login_successful_handler(LoginSnapshot login);
 	void login_failed_handler(QString reason);
 	void registration_successful_handler();
 	void registration_failed_handler(QString reason);
 
 	void exit_handler();
 	void disconnection_handler();
+	void connection_lost_handler();
+	void connection_established_handler();
+	void rtt_measured_handler(int rtt_in_milliseconds);
 
 	void friend_request_handler(QString request_target);
 	void sent_message_handler(QString message_content, QString message_target);
@@ -109,9 +111,10 @@ public slots:
 
 	void forced_logout_handler(QString reason);
 
-	void update_chatbox_slot(bool is_for_new_message);
+	void schedule_ui_flush();
+	void flush_ui_updates();
 
-	void update_friend_icons(nlohmann::json friend_statuses);
+	void update_friend_icons(const std::vector<std::pair<std::string, bool>>& friend_statuses);
 
 	void play_sfx(SoundEffect which_sfx);
 	void create_alert(int duration_in_milliseconds);
@@ -123,32 +126,82 @@ private:
 	ChatWindow chat_window;
 	ConnectionManager connection_manager;
 
-	std::mutex mutex;
-	std::vector<nlohmann::json> received_messages;
-	std::thread network_thread;
+	BlockingQueue<ServerMessage> received_messages;
+
+	// Widgets are only touched on the GUI thread: the message processor thread queues updates here and flush_ui_updates applies them.
+	std::mutex ui_update_mutex;
+	std::vector<std::function<void()>> pending_ui_updates;
+	std::atomic<bool> ui_flush_scheduled { false };
+	QTimer ui_flush_timer;
+	bool chatbox_refresh_pending = false; // Only touched on the GUI thread.
+	bool chatbox_refresh_is_for_new_message = false;
+	std::set<SoundEffect> sfx_to_play; // Each one is played once at the end of the flush, however many updates asked for it.
+	int alert_duration_in_milliseconds = 0; // The longest alert asked for during the flush, 0 if none was.
+
+	std::vector<ServerMessage> decoded_frames; // Only used on the connection's I/O thread.
+	HistoryDecoder history_decoder;
 	std::thread message_processor_thread;
-	std::thread friend_status_checker_thread;
 
-	// These functions will run in a while(true) loop on seperate threads.
-	void receive_and_parse_forever();
+	// New messages that come in while a history page of the same friend is still being decoded wait here, so they end up after it.
+	std::unordered_map<QString, int, QStringHasher> history_pages_in_flight; // Only touched on the GUI thread.
+	std::unordered_map<QString, std::vector<StoredMessage>, QStringHasher> messages_waiting_for_history;
+
+	// max_index of every fetch-messages-request still waiting for a response, per friend. The server answers them in order.
+	std::mutex history_requests_mutex;
+	std::unordered_map<QString, std::deque<int>, QStringHasher> unanswered_history_requests;
+
+	// Friend and ChatWindow's send id (0 if it isn't shown) of every send-message still waiting for its result. The results name no message, the server answers in order.
+	std::mutex sent_messages_mutex;
+	std::deque<std::pair<QString, uint64_t>> unanswered_sent_messages;
+
+	// One entry per get-statuses still waiting for its response, true for the heartbeat's probes. The responses name no request, the server answers in order.
+	std::mutex status_requests_mutex;
+	std::deque<bool> unanswered_status_requests;
+
+	ClientConfig client_config;
+
+	// The connection comes back on its own after a drop, the session is then resumed by logging in again. Only touched on the GUI thread.
+	QString session_password; // Kept while logged in for that, cleared on logout.
+	bool is_reconnecting = false;
+	bool is_resuming_session = false;
+	std::string request_waiting_for_connection; // A login or registration made before the connection was up, sent once it is.
+	PresenceTracker presence_tracker; // Only touched on the GUI thread.
+	QTimer presence_resync_timer;
+
+	void parse_and_queue_frames(std::vector<std::string>& frames); // Runs on the connection's I/O thread.
+	RequestWriter new_request(std::string_view message_type); // Starts the request in a buffer recycled by connection_manager.
+	void send_when_connected(std::string message); // Only for login and registration, a newer request replaces one that is still waiting.
+	bool send_to_server(std::string message); // Tells the user when the outbound queue is full. Returns true if the message was queued.
+	bool report_send_result(SendResult result); // The part of send_to_server that tells the user, for callers that send themselves.
+
+	void process_received_message(ServerMessage& received_message); // Calls the handler below that matches the message type.
+	void unexpected_error_received(ErrorMessage& message);
+	void login_authentication_received(LoginAuthentication& message);
+	void registration_confirmation_received(RegistrationConfirmation& message);
+	void friend_request_result_received(FriendRequestResult& message);
+	void send_message_result_received(SendMessageResult& message);
+	void new_message_received(NewMessage& message);
+	void new_friendship_request_received(NewFriendshipRequest& message);
+	void friendship_request_update_received(FriendshipRequestUpdate& message);
+	void friend_deletion_update_received(FriendDeletionUpdate& message);
+	void deleted_by_friend_received(DeletedByFriend& message);
+	void forced_logout_received(ForcedLogout& message);
+	void fetch_messages_response_received(FetchMessagesResponse& message);
+	void dummy_message_received(DummyMessage& message);
+	void status_response_received(StatusResponse& message);
+	void statuses_response_received(StatusesResponse& message);
+	void history_page_decoded(DecodedHistoryPage& page); // GUI thread only.
+	int take_history_request(const QString& friend_username); // Returns the max_index the next response for this friend answers.
+	SendResult send_status_request(std::string request, bool is_heartbeat_probe); // Sends a get-statuses and records it for take_status_request. Thread-safe.
+	bool take_status_request(); // Returns true if the next statuses response answers a heartbeat probe.
+	void forget_status_requests(); // Their responses won't come, call before the heartbeat starts on a new connection.
+	void queue_ui_update(std::function<void()> update); // Can be called from any thread.
+	void request_chatbox_refresh(bool is_for_new_message); // GUI thread only, the refresh happens at the end of the current flush.
+	void request_sfx(SoundEffect which_sfx); // GUI thread only, like request_chatbox_refresh.
+	void request_alert(int duration_in_milliseconds); // GUI thread only, like request_chatbox_refresh.
+	void resume_session(const LoginSnapshot& login); // Picks up where the session left off before the connection dropped, keeping the loaded histories.
+	void update_window_title();
+
+	// This function will run in a while(true) loop on a seperate thread.
 	void process_received_forever();
-	void check_friend_statuses_forever();
-
-	std::map<std::string, ReceivedMessageType> received_string_to_enum {
-		{"unexpected-error", ReceivedMessageType::ERROR_MESSAGE},
-		{"login-authentication", ReceivedMessageType::LOGIN_AUTHENTICATION},
-		{"registration-confirmation", ReceivedMessageType::REGISTRATION_CONFIRMATION},
-		{"friend-request-result", ReceivedMessageType::FRIEND_REQUEST_RESULT},
-		{"send-message-result", ReceivedMessageType::SEND_MESSAGE_RESULT},
-		{"new-message", ReceivedMessageType::NEW_MESSAGE},
-		{"new-friendship-request", ReceivedMessageType::NEW_FRIENDSHIP_REQUEST},
-		{"friend-request-update", ReceivedMessageType::FRIENDSHIP_REQUEST_UPDATE},
-		{"friend-deletion-update", ReceivedMessageType::FRIEND_DELETION_UPDATE},
-		{"deleted-by-friend", ReceivedMessageType::DELETED_BY_FRIEND},
-		{"forced-logout", ReceivedMessageType::FORCED_LOGOUT},
-		{"fetch-messages-request-response", ReceivedMessageType::FETCH_MESSAGES_REQUEST_RESPONSE},
-		{"dummy-message", ReceivedMessageType::DUMMY_MESSAGE},
-		{"get-status-response", ReceivedMessageType::GET_STATUS_RESPONSE},
-		{"get-statuses-response", ReceivedMessageType::GET_STATUSES_RESPONSE}
-	};
 };
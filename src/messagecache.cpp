@@ -0,0 +1,313 @@
+#include "messagecache.h"
+
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <numeric>
+#include <iterator>
+
+void MessageCache::open(const QString& account_username) {
+	close();
+
+	directory = QDir(QDir::current().filePath("cache/" + file_name(account_username)));
+
+	if (!directory.mkpath(".")) {
+		std::cerr << "Can't create the message cache directory " << directory.path().toStdString() << ", history won't be cached." << "\n";
+		return;
+	}
+
+	is_opened = true;
+
+	search_index.open(directory.filePath("search.idx"));
+	index_uncached_messages();
+	search_index.flush();
+}
+
+void MessageCache::index_uncached_messages() {
+	for (auto&& log_file_name : directory.entryList(QStringList() << "*.log", QDir::Files)) {
+		index_uncached_messages(QString::fromUtf8(QByteArray::fromHex(log_file_name.chopped(4).toLatin1())));
+	}
+}
+
+void MessageCache::index_uncached_messages(const QString& friend_username) {
+	size_t cached_message_count = message_count(friend_username);
+	size_t indexed_message_count = search_index.indexed_message_count(friend_username);
+
+	if (indexed_message_count > cached_message_count) { // Indexed messages that never made it to the log, e.g. after a failed write.
+		search_index.remove(friend_username);
+		indexed_message_count = 0;
+	}
+
+	if (indexed_message_count < cached_message_count)
+		search_index.add(friend_username, indexed_message_count, load(friend_username, indexed_message_count, cached_message_count - indexed_message_count));
+}
+
+void MessageCache::close() {
+	if (is_opened)
+		flush();
+
+	open_files.clear(); // QFile closes itself.
+	search_index.close();
+	is_opened = false;
+}
+
+bool MessageCache::is_open() const {
+	return is_opened;
+}
+
+QString MessageCache::file_name(const QString& username) {
+	return QString::fromLatin1(username.toUtf8().toHex());
+}
+
+MessageCache::ConversationFiles* MessageCache::get_files(const QString& friend_username) {
+	if (!is_opened)
+		return nullptr;
+
+	auto it = open_files.find(friend_username);
+
+	if (it != open_files.end())
+		return it->second.get();
+
+	auto files = std::make_unique<ConversationFiles>();
+	QString base_name = file_name(friend_username);
+
+	files->log.setFileName(directory.filePath(base_name + ".log"));
+	files->index.setFileName(directory.filePath(base_name + ".idx"));
+
+	if (!files->log.open(QIODevice::ReadWrite | QIODevice::Append) || !files->index.open(QIODevice::ReadWrite | QIODevice::Append)) {
+		std::cerr << "Can't open the message cache of " << friend_username.toStdString() << ": " << files->log.errorString().toStdString() << "\n";
+		return nullptr;
+	}
+
+	// A crash in the middle of an append can leave a partial entry behind, only index entries that point at whole records count.
+	size_t message_count = static_cast<size_t>(files->index.size()) / sizeof(uint64_t);
+
+	while (message_count > 0) {
+		uint64_t last_offset = 0;
+		RecordHeader header {};
+
+		files->index.seek((message_count - 1) * sizeof(uint64_t));
+		files->index.read(reinterpret_cast<char*>(&last_offset), sizeof(last_offset));
+		files->log.seek(last_offset);
+
+		if (files->log.read(reinterpret_cast<char*>(&header), sizeof(header)) == sizeof(header) &&
+			last_offset + sizeof(header) + header.sent_by_size + header.content_size <= static_cast<uint64_t>(files->log.size()))
+			break;
+
+		message_count--;
+	}
+
+	if (message_count * sizeof(uint64_t) != static_cast<size_t>(files->index.size()))
+		files->index.resize(message_count * sizeof(uint64_t));
+
+	files->message_count = message_count;
+	files->log_size = static_cast<uint64_t>(files->log.size());
+
+	return open_files.emplace(friend_username, std::move(files)).first->second.get();
+}
+
+MessageCache::ConversationFiles* MessageCache::get_written_files(const QString& friend_username) {
+	ConversationFiles* files = get_files(friend_username);
+
+	if (files == nullptr || write_buffered(friend_username, *files))
+		return files;
+
+	reopen_after_failed_write(friend_username);
+	return get_files(friend_username);
+}
+
+size_t MessageCache::message_count(const QString& friend_username) {
+	ConversationFiles* files = get_files(friend_username);
+	return files != nullptr ? files->message_count : 0;
+}
+
+std::vector<StoredMessage> MessageCache::load(const QString& friend_username, size_t first_index, size_t count) {
+	ConversationFiles* files = get_written_files(friend_username);
+
+	if (files == nullptr || first_index >= files->message_count)
+		return std::vector<StoredMessage>();
+
+	std::vector<size_t> message_indices(std::min(count, files->message_count - first_index));
+	std::iota(message_indices.begin(), message_indices.end(), first_index);
+
+	return read_records(friend_username, *files, message_indices);
+}
+
+std::vector<StoredMessage> MessageCache::load_each(const QString& friend_username, const std::vector<size_t>& message_indices) {
+	ConversationFiles* files = get_written_files(friend_username);
+
+	if (files == nullptr)
+		return std::vector<StoredMessage>();
+
+	std::vector<size_t> cached_indices;
+	cached_indices.reserve(message_indices.size());
+	std::copy_if(message_indices.begin(), message_indices.end(), std::back_inserter(cached_indices), [files](size_t i) { return i < files->message_count; });
+
+	return read_records(friend_username, *files, cached_indices);
+}
+
+std::vector<StoredMessage> MessageCache::read_records(const QString& friend_username, ConversationFiles& files, const std::vector<size_t>& message_indices) {
+	std::vector<StoredMessage> messages;
+
+	if (message_indices.empty())
+		return messages;
+
+	qint64 log_size = files.log.size();
+	qint64 index_size = static_cast<qint64>(files.message_count * sizeof(uint64_t));
+	uchar* log_data = log_size > 0 ? files.log.map(0, log_size) : nullptr;
+	uchar* index_data = index_size > 0 ? files.index.map(0, index_size) : nullptr;
+
+	if (log_data == nullptr || index_data == nullptr) {
+		std::cerr << "Can't map the message cache of " << friend_username.toStdString() << "." << "\n";
+
+		if (log_data != nullptr) files.log.unmap(log_data);
+		if (index_data != nullptr) files.index.unmap(index_data);
+
+		return messages;
+	}
+
+	messages.reserve(message_indices.size());
+	uint64_t mapped_log_size = static_cast<uint64_t>(log_size);
+
+	for (size_t i : message_indices) {
+		uint64_t offset;
+		RecordHeader header;
+
+		std::memcpy(&offset, index_data + i * sizeof(uint64_t), sizeof(offset));
+
+		// get_files only checked the last record, an index entry that points past the log means the files are corrupt.
+		bool is_whole = offset <= mapped_log_size && mapped_log_size - offset >= sizeof(header);
+
+		if (is_whole) {
+			std::memcpy(&header, log_data + offset, sizeof(header));
+			is_whole = mapped_log_size - offset - sizeof(header) >= static_cast<uint64_t>(header.sent_by_size) + header.content_size;
+		}
+
+		if (!is_whole) {
+			std::cerr << "The message cache of " << friend_username.toStdString() << " is corrupt, dropping it." << "\n";
+			files.log.unmap(log_data);
+			files.index.unmap(index_data);
+			remove(friend_username); // Starts over empty, like a conversation that was never cached.
+			return std::vector<StoredMessage>();
+		}
+
+		const char* sent_by = reinterpret_cast<const char*>(log_data + offset + sizeof(header));
+		const char* content = sent_by + header.sent_by_size;
+
+		messages.push_back(StoredMessage{ header.sent_at, UsernameTable::instance().intern_utf8(std::string_view(sent_by, header.sent_by_size)), std::string(content, header.content_size) });
+	}
+
+	files.log.unmap(log_data);
+	files.index.unmap(index_data);
+
+	return messages;
+}
+
+void MessageCache::buffer_record(ConversationFiles& files, const StoredMessage& message) {
+	const std::string& sent_by = UsernameTable::instance().utf8_name(message.sent_by);
+	RecordHeader header { message.sent_at, static_cast<uint32_t>(sent_by.size()), static_cast<uint32_t>(message.content.size()) };
+
+	files.buffered_offsets.append(reinterpret_cast<const char*>(&files.log_size), sizeof(files.log_size));
+	files.buffered_records.append(reinterpret_cast<const char*>(&header), sizeof(header));
+	files.buffered_records.append(sent_by);
+	files.buffered_records.append(message.content);
+
+	files.log_size += sizeof(header) + sent_by.size() + message.content.size();
+	files.message_count++;
+}
+
+void MessageCache::append(const QString& friend_username, const StoredMessage& message) {
+	ConversationFiles* files = get_files(friend_username);
+
+	if (files == nullptr)
+		return;
+
+	search_index.add(friend_username, files->message_count, message);
+	buffer_record(*files, message);
+}
+
+void MessageCache::append(const QString& friend_username, const std::vector<StoredMessage>& oldest_first_messages) {
+	ConversationFiles* files = get_files(friend_username);
+
+	if (files == nullptr || oldest_first_messages.empty())
+		return;
+
+	search_index.add(friend_username, files->message_count, oldest_first_messages);
+
+	for (auto&& message : oldest_first_messages) {
+		buffer_record(*files, message);
+	}
+}
+
+bool MessageCache::write_buffered(const QString& friend_username, ConversationFiles& files) {
+	if (files.buffered_offsets.empty())
+		return true;
+
+	qint64 records_size = static_cast<qint64>(files.buffered_records.size());
+	qint64 offsets_size = static_cast<qint64>(files.buffered_offsets.size());
+
+	// The log goes first, so an index entry never points at a record that isn't there.
+	bool is_written = files.log.write(files.buffered_records.data(), records_size) == records_size && files.log.flush() &&
+		files.index.write(files.buffered_offsets.data(), offsets_size) == offsets_size && files.index.flush();
+
+	files.buffered_records.clear();
+	files.buffered_offsets.clear();
+
+	if (!is_written)
+		std::cerr << "Can't write to the message cache of " << friend_username.toStdString() << ": " << files.log.errorString().toStdString() << "\n";
+
+	return is_written;
+}
+
+void MessageCache::reopen_after_failed_write(const QString& friend_username) {
+	open_files.erase(friend_username); // Reopening checks what actually made it to the disk.
+	index_uncached_messages(friend_username); // The search index already has the messages that were lost.
+}
+
+void MessageCache::flush() {
+	std::vector<QString> failed_friends;
+
+	for (auto&& [friend_username, files] : open_files) {
+		if (!write_buffered(friend_username, *files))
+			failed_friends.push_back(friend_username);
+	}
+
+	for (auto&& friend_username : failed_friends) {
+		reopen_after_failed_write(friend_username);
+	}
+
+	search_index.flush();
+}
+
+void MessageCache::replace(const QString& friend_username, const std::vector<StoredMessage>& oldest_first_messages) {
+	ConversationFiles* files = get_files(friend_username);
+
+	if (files == nullptr)
+		return;
+
+	files->index.resize(0);
+	files->log.resize(0);
+	files->message_count = 0;
+	files->log_size = 0;
+	files->buffered_records.clear();
+	files->buffered_offsets.clear();
+	search_index.remove(friend_username);
+
+	append(friend_username, oldest_first_messages);
+}
+
+void MessageCache::remove(const QString& friend_username) {
+	ConversationFiles* files = get_files(friend_username);
+
+	if (files == nullptr)
+		return;
+
+	files->log.remove();
+	files->index.remove();
+	open_files.erase(friend_username);
+	search_index.remove(friend_username);
+}
+
+std::vector<SearchHit> MessageCache::search(const QString& query, size_t max_hit_count) const {
+	return search_index.search(query, max_hit_count);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <QString>
+#include <QFile>
+#include <QDir>
+#include <QByteArray>
+#include <QStringList>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <string>
+#include <cstdint>
+#include "conversationstore.h"
+#include "searchindex.h"
+#include "usernametable.h"
+
+/* On-disk history of every conversation of the logged in account, under cache/<account>/. Each conversation has an append-only log of
+messages, oldest first, and an index file with the offset of every record in the log, so any range of messages can be read straight out of
+the memory-mapped log. File names are the hex-encoded UTF-8 usernames, which keeps them valid on every file system. Everything that is cached
+also goes into the search index, which is kept in the same directory. Appends are buffered and written out by flush(). */
+class MessageCache {
+	private:
+		struct ConversationFiles {
+			QFile log;
+			QFile index;
+			size_t message_count = 0; // Including the buffered messages.
+			uint64_t log_size = 0; // Including the buffered records.
+			std::string buffered_records; // Appended since the last write, cleared without giving up their capacity.
+			std::string buffered_offsets;
+		};
+
+		// A log record is this header followed by the sender's name and the content, both UTF-8.
+		struct RecordHeader {
+			uint64_t sent_at;
+			uint32_t sent_by_size;
+			uint32_t content_size;
+		};
+
+		QDir directory;
+		bool is_opened = false;
+		std::unordered_map<QString, std::unique_ptr<ConversationFiles>, QStringHasher> open_files;
+		SearchIndex search_index;
+
+		ConversationFiles* get_files(const QString& friend_username); // Opens or creates the files on first use. Returns nullptr on failure.
+		static QString file_name(const QString& username);
+		void index_uncached_messages(); // Catches the search index up with logs written without it, or back down to them.
+		void index_uncached_messages(const QString& friend_username);
+		void buffer_record(ConversationFiles& files, const StoredMessage& message);
+		bool write_buffered(const QString& friend_username, ConversationFiles& files); // Returns false if a write failed, the files then need reopening.
+		void reopen_after_failed_write(const QString& friend_username);
+		ConversationFiles* get_written_files(const QString& friend_username); // Like get_files, with the buffered records written so they can be read.
+		// Maps the files once for all of them. Drops the conversation's cache if a record doesn't fit in the log, files is gone then.
+		std::vector<StoredMessage> read_records(const QString& friend_username, ConversationFiles& files, const std::vector<size_t>& message_indices);
+
+	public:
+		void open(const QString& account_username);
+		void close();
+		bool is_open() const;
+
+		size_t message_count(const QString& friend_username);
+		std::vector<StoredMessage> load(const QString& friend_username, size_t first_index, size_t count); // Oldest first.
+		std::vector<StoredMessage> load_each(const QString& friend_username, const std::vector<size_t>& message_indices); // In the given order, skipping indices past the end.
+
+		void append(const QString& friend_username, const StoredMessage& message);
+		void append(const QString& friend_username, const std::vector<StoredMessage>& oldest_first_messages);
+		void replace(const QString& friend_username, const std::vector<StoredMessage>& oldest_first_messages);
+		void remove(const QString& friend_username);
+		void flush(); // Writes what was appended since the last call, along with the search index's journal. Call once per batch of appends.
+
+		std::vector<SearchHit> search(const QString& query, size_t max_hit_count) const;
+};
@@ -0,0 +1,100 @@
+#include "messagelistmodel.h"
+
+#include <algorithm>
+
+MessageListModel::MessageListModel(QObject* parent) : QAbstractListModel(parent) {
+}
+
+int MessageListModel::rowCount(const QModelIndex& parent) const {
+	if (parent.isValid())
+		return 0;
+
+	if (!placeholder_text.isEmpty())
+		return 1;
+
+	return shown_row_count;
+}
+
+QVariant MessageListModel::data(const QModelIndex& index, int role) const {
+	if (!index.isValid() || role != Qt::DisplayRole)
+		return QVariant();
+
+	if (!placeholder_text.isEmpty())
+		return placeholder_text;
+
+	const StoredMessage& message = conversation->at(index.row()); // Row 0 is the oldest message.
+	QString sent_at = QString::fromStdString(Globals::time::unix_time_to_readable_string(message.sent_at));
+
+	return Globals::generate_message(sent_at, UsernameTable::instance().name(message.sent_by), QString::fromUtf8(message.content.data(), static_cast<int>(message.content.size())));
+}
+
+void MessageListModel::show_conversation(const QString& friend_username, const Conversation* conversation) {
+	beginResetModel();
+	shown_friend = friend_username;
+	this->conversation = conversation;
+	shown_row_count = conversation != nullptr ? static_cast<int>(conversation->size()) : 0;
+	shown_pending_count = conversation != nullptr ? static_cast<int>(conversation->pending_count()) : 0;
+	placeholder_text.clear();
+	endResetModel();
+}
+
+void MessageListModel::messages_appended() {
+	if (conversation == nullptr || !placeholder_text.isEmpty())
+		return;
+
+	int new_row_count = static_cast<int>(conversation->size());
+	int first_changed_row = shown_row_count - shown_pending_count; // Rows before it are server messages, which never change.
+
+	if (new_row_count > shown_row_count) {
+		beginInsertRows(QModelIndex(), shown_row_count, new_row_count - 1);
+		shown_row_count = new_row_count;
+		endInsertRows();
+	}
+	else if (new_row_count < shown_row_count) {
+		beginRemoveRows(QModelIndex(), new_row_count, shown_row_count - 1);
+		shown_row_count = new_row_count;
+		endRemoveRows();
+	}
+
+	// The rows that showed pending messages may now show the server's copies, or the pending messages that came after them.
+	int last_changed_row = std::min(shown_row_count, first_changed_row + shown_pending_count) - 1;
+
+	if (shown_pending_count > 0 && first_changed_row <= last_changed_row)
+		emit dataChanged(index(first_changed_row), index(last_changed_row));
+
+	shown_pending_count = static_cast<int>(conversation->pending_count());
+}
+
+void MessageListModel::messages_prepended(int count) {
+	if (conversation == nullptr || !placeholder_text.isEmpty() || count <= 0)
+		return;
+
+	// Row i is still conversation->at(i), so appended messages that aren't shown yet stay past the last row.
+	beginInsertRows(QModelIndex(), 0, count - 1);
+	shown_row_count += count;
+	endInsertRows();
+}
+
+void MessageListModel::show_placeholder(const QString& text) {
+	beginResetModel();
+	shown_friend.clear();
+	conversation = nullptr;
+	shown_row_count = 0;
+	shown_pending_count = 0;
+	placeholder_text = text;
+	endResetModel();
+}
+
+void MessageListModel::clear() {
+	beginResetModel();
+	shown_friend.clear();
+	conversation = nullptr;
+	shown_row_count = 0;
+	shown_pending_count = 0;
+	placeholder_text.clear();
+	endResetModel();
+}
+
+QString MessageListModel::get_shown_friend() const {
+	return shown_friend;
+}
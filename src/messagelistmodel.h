@@ -0,0 +1,36 @@
+#pragma once
+
+#include <QAbstractListModel>
+#include <QVariant>
+#include <QString>
+#include "globals.h"
+#include "conversationstore.h"
+#include "usernametable.h"
+
+/* Model behind ChatWindow's message pane. It reads straight from the conversation store and only formats the rows the view asks for,
+so showing a conversation costs the same no matter how long its history is. */
+class MessageListModel : public QAbstractListModel
+{
+	Q_OBJECT
+
+public:
+	MessageListModel(QObject* parent = Q_NULLPTR);
+
+	int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+	QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+
+	void show_conversation(const QString& friend_username, const Conversation* conversation);
+	void messages_appended(); // Syncs the rows at the end with the shown conversation: messages appended since the last call, and pending messages that were added, replaced or dropped.
+	void messages_prepended(int count); // Inserts rows at the top for a page of older messages, right after it was prepended.
+	void show_placeholder(const QString& text); // Shows a single informational row, e.g. while messages are being fetched.
+	void clear();
+
+	QString get_shown_friend() const;
+
+private:
+	QString shown_friend;
+	const Conversation* conversation = nullptr; // Owned by the ConversationStore.
+	int shown_row_count = 0; // Rows the view knows about, which can lag behind the conversation until messages_appended is called.
+	int shown_pending_count = 0; // The last rows the view knows about, which showed pending messages.
+	QString placeholder_text;
+};
@@ -0,0 +1,45 @@
+#include "presencetracker.h"
+#include <algorithm>
+
+std::vector<std::pair<std::string, bool>> PresenceTracker::apply(const std::vector<std::pair<std::string, bool>>& friend_statuses) {
+	std::vector<std::pair<std::string, bool>> changed_statuses;
+
+	for (auto&& [friend_username, is_online] : friend_statuses) {
+		if (apply(friend_username, is_online))
+			changed_statuses.emplace_back(friend_username, is_online);
+	}
+
+	return changed_statuses;
+}
+
+bool PresenceTracker::apply(const std::string& friend_username, bool is_online) {
+	auto [it, is_new] = known_statuses.try_emplace(friend_username, is_online);
+
+	if (is_new)
+		return true;
+
+	if (it->second == is_online)
+		return false;
+
+	it->second = is_online;
+	return true;
+}
+
+void PresenceTracker::forget(const std::string& friend_username) {
+	known_statuses.erase(friend_username);
+}
+
+void PresenceTracker::clear() {
+	known_statuses.clear();
+}
+
+std::vector<std::vector<std::string>> PresenceTracker::make_batches(const std::vector<std::string>& friends, size_t batch_size) {
+	std::vector<std::vector<std::string>> batches;
+
+	for (size_t i = 0; i < friends.size(); i += batch_size) {
+		size_t batch_end = std::min(friends.size(), i + batch_size);
+		batches.emplace_back(friends.begin() + i, friends.begin() + batch_end);
+	}
+
+	return batches;
+}
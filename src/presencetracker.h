@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+
+// Remembers the last status shown for every friend, so status responses only cause work for the friends whose status actually changed.
+class PresenceTracker {
+	private:
+		std::unordered_map<std::string, bool> known_statuses;
+
+	public:
+		// Records every status in friend_statuses and returns only the ones that changed.
+		std::vector<std::pair<std::string, bool>> apply(const std::vector<std::pair<std::string, bool>>& friend_statuses);
+		bool apply(const std::string& friend_username, bool is_online); // Returns true if the status changed.
+
+		void forget(const std::string& friend_username);
+		void clear();
+
+		// Splits friends into groups of at most batch_size, one group per get-statuses request.
+		static std::vector<std::vector<std::string>> make_batches(const std::vector<std::string>& friends, size_t batch_size);
+};
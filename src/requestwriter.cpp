@@ -0,0 +1,161 @@
+#include "requestwriter.h"
+
+#include <charconv>
+
+RequestWriter::RequestWriter(std::string buffer, std::string_view message_type) : buffer(std::move(buffer)) {
+	this->buffer.clear();
+	this->buffer += '{';
+	write_key("message-type");
+	write_string(message_type);
+}
+
+void RequestWriter::write_key(std::string_view key) {
+	if (buffer.size() > 1) // Anything past the opening brace is a previous field.
+		buffer += ',';
+
+	write_string(key);
+	buffer += ':';
+}
+
+void RequestWriter::write_escaped_ascii(char character) {
+	static constexpr char hex_digits[] = "0123456789abcdef";
+
+	switch (character) {
+		case '"': buffer += "\\\""; break;
+		case '\\': buffer += "\\\\"; break;
+		case '\b': buffer += "\\b"; break;
+		case '\f': buffer += "\\f"; break;
+		case '\n': buffer += "\\n"; break;
+		case '\r': buffer += "\\r"; break;
+		case '\t': buffer += "\\t"; break;
+		default:
+			if (static_cast<unsigned char>(character) < 0x20) {
+				buffer += "\\u00";
+				buffer += hex_digits[character >> 4];
+				buffer += hex_digits[character & 0xF];
+			}
+			else {
+				buffer += character;
+			}
+	}
+}
+
+void RequestWriter::write_string(std::string_view utf8_value) {
+	buffer += '"';
+
+	// Runs of characters that don't need escaping are appended in one go.
+	size_t run_start = 0;
+
+	for (size_t i = 0; i < utf8_value.size(); i++) {
+		unsigned char character = static_cast<unsigned char>(utf8_value[i]);
+
+		if (character >= 0x20 && character != '"' && character != '\\')
+			continue;
+
+		buffer.append(utf8_value.data() + run_start, i - run_start);
+		write_escaped_ascii(static_cast<char>(character));
+		run_start = i + 1;
+	}
+
+	buffer.append(utf8_value.data() + run_start, utf8_value.size() - run_start);
+	buffer += '"';
+}
+
+void RequestWriter::write_string(const QString& value) {
+	buffer += '"';
+
+	const QChar* characters = value.constData();
+	int length = value.size();
+
+	for (int i = 0; i < length; i++) {
+		char32_t code_point = characters[i].unicode();
+
+		if (code_point < 0x80) {
+			write_escaped_ascii(static_cast<char>(code_point));
+			continue;
+		}
+
+		if (QChar::isHighSurrogate(code_point) && i + 1 < length && characters[i + 1].isLowSurrogate()) {
+			code_point = QChar::surrogateToUcs4(characters[i].unicode(), characters[i + 1].unicode());
+			i++;
+		}
+		else if (QChar::isSurrogate(code_point)) // Unpaired, JSON can't carry it as UTF-8.
+			code_point = 0xFFFD;
+
+		if (code_point < 0x800) {
+			buffer += static_cast<char>(0xC0 | (code_point >> 6));
+		}
+		else if (code_point < 0x10000) {
+			buffer += static_cast<char>(0xE0 | (code_point >> 12));
+			buffer += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+		}
+		else {
+			buffer += static_cast<char>(0xF0 | (code_point >> 18));
+			buffer += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+			buffer += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+		}
+
+		buffer += static_cast<char>(0x80 | (code_point & 0x3F));
+	}
+
+	buffer += '"';
+}
+
+RequestWriter& RequestWriter::field(std::string_view key, std::string_view value) {
+	write_key(key);
+	write_string(value);
+	return *this;
+}
+
+RequestWriter& RequestWriter::field(std::string_view key, const char* value) {
+	return field(key, std::string_view(value));
+}
+
+RequestWriter& RequestWriter::field(std::string_view key, const std::string& value) {
+	return field(key, std::string_view(value));
+}
+
+RequestWriter& RequestWriter::field(std::string_view key, const QString& value) {
+	write_key(key);
+	write_string(value);
+	return *this;
+}
+
+RequestWriter& RequestWriter::field(std::string_view key, bool value) {
+	write_key(key);
+	buffer += value ? "true" : "false";
+	return *this;
+}
+
+RequestWriter& RequestWriter::field(std::string_view key, long long value) {
+	char digits[24];
+	auto result = std::to_chars(digits, digits + sizeof(digits), value);
+
+	write_key(key);
+	buffer.append(digits, result.ptr - digits);
+	return *this;
+}
+
+RequestWriter& RequestWriter::field(std::string_view key, int value) {
+	return field(key, static_cast<long long>(value));
+}
+
+RequestWriter& RequestWriter::field(std::string_view key, const std::vector<std::string>& values) {
+	write_key(key);
+	buffer += '[';
+
+	for (size_t i = 0; i < values.size(); i++) {
+		if (i != 0)
+			buffer += ',';
+
+		write_string(std::string_view(values[i]));
+	}
+
+	buffer += ']';
+	return *this;
+}
+
+std::string RequestWriter::finish() {
+	buffer += '}';
+	return std::move(buffer);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <QString>
+
+/* Writes a flat JSON request straight into a string, usually a buffer recycled by ConnectionManager::acquire_buffer, so building a request
+doesn't allocate once the buffer has grown to fit. Fields are written in the order they are added. */
+class RequestWriter {
+	private:
+		std::string buffer;
+
+		void write_key(std::string_view key);
+		void write_string(std::string_view utf8_value);
+		void write_string(const QString& value); // Encodes to UTF-8 as it goes, without a temporary QByteArray.
+		void write_escaped_ascii(char character);
+
+	public:
+		RequestWriter(std::string buffer, std::string_view message_type); // Clears the buffer but keeps its capacity.
+
+		RequestWriter& field(std::string_view key, std::string_view value);
+		RequestWriter& field(std::string_view key, const char* value);
+		RequestWriter& field(std::string_view key, const std::string& value);
+		RequestWriter& field(std::string_view key, const QString& value);
+		RequestWriter& field(std::string_view key, bool value);
+		RequestWriter& field(std::string_view key, long long value);
+		RequestWriter& field(std::string_view key, int value);
+		RequestWriter& field(std::string_view key, const std::vector<std::string>& values);
+
+		std::string finish(); // Closes the object and gives the buffer back, ready for ConnectionManager::send.
+};
@@ -0,0 +1,364 @@
+#include "searchindex.h"
+
+#include <iostream>
+#include <algorithm>
+
+void SearchIndex::open(const QString& journal_path) {
+	close();
+
+	journal.setFileName(journal_path);
+
+	if (!journal.open(QIODevice::ReadWrite)) {
+		std::cerr << "Can't open the search index " << journal_path.toStdString() << ": " << journal.errorString().toStdString() << "\n";
+		return;
+	}
+
+	journal_stream.setDevice(&journal);
+	journal_stream.setVersion(QDataStream::Qt_5_0); // Keeps the format the same whichever Qt version wrote it.
+	replay_journal();
+	compact_journal_if_needed();
+}
+
+void SearchIndex::close() {
+	journal_stream.setDevice(nullptr);
+	journal.close();
+
+	conversation_names.clear();
+	indexed_message_counts.clear();
+	conversation_ids.clear();
+	postings.clear();
+	conversation_words.clear();
+	journal_message_count = 0;
+	live_message_count = 0;
+}
+
+void SearchIndex::replay_journal() {
+	qint64 last_complete_record_end = 0;
+
+	while (!journal_stream.atEnd()) {
+		quint8 record_type;
+		journal_stream >> record_type;
+
+		if (record_type == CONVERSATION_ADDED) {
+			QString friend_username;
+			journal_stream >> friend_username;
+
+			if (journal_stream.status() == QDataStream::Ok)
+				add_conversation(friend_username);
+		}
+		else if (record_type == CONVERSATION_REMOVED) {
+			quint32 conversation_id;
+			journal_stream >> conversation_id;
+
+			if (journal_stream.status() == QDataStream::Ok && conversation_id < conversation_names.size())
+				remove_conversation(conversation_id);
+		}
+		else if (record_type == MESSAGE_ADDED) {
+			quint32 conversation_id;
+			quint32 message_index;
+			quint64 sent_at;
+			quint32 word_count;
+			std::vector<QString> words;
+
+			journal_stream >> conversation_id >> message_index >> sent_at >> word_count;
+			journal_message_count++;
+
+			for (quint32 i = 0; i < word_count && journal_stream.status() == QDataStream::Ok; i++) {
+				QString word;
+				journal_stream >> word;
+				words.push_back(std::move(word));
+			}
+
+			if (journal_stream.status() == QDataStream::Ok && conversation_id < conversation_names.size())
+				add_message(conversation_id, message_index, sent_at, words);
+		}
+		else {
+			journal_stream.setStatus(QDataStream::ReadCorruptData);
+		}
+
+		if (journal_stream.status() != QDataStream::Ok)
+			break;
+
+		last_complete_record_end = journal.pos();
+	}
+
+	// Whatever is after the last complete record is from a write that didn't finish, new records go in its place.
+	if (journal_stream.status() != QDataStream::Ok) {
+		std::cerr << "The search index ends in a partial record, dropping it." << "\n";
+		journal_stream.resetStatus();
+		journal.resize(last_complete_record_end);
+	}
+
+	journal.seek(last_complete_record_end);
+}
+
+uint32_t SearchIndex::add_conversation(const QString& friend_username) {
+	auto existing = conversation_ids.find(friend_username);
+
+	if (existing != conversation_ids.end())
+		remove_conversation(existing->second);
+
+	uint32_t conversation_id = static_cast<uint32_t>(conversation_names.size());
+
+	conversation_names.push_back(friend_username);
+	indexed_message_counts.push_back(0);
+	conversation_words.emplace_back();
+	conversation_ids[friend_username] = conversation_id;
+
+	return conversation_id;
+}
+
+void SearchIndex::remove_conversation(uint32_t conversation_id) {
+	if (conversation_names[conversation_id].isEmpty())
+		return;
+
+	conversation_ids.erase(conversation_names[conversation_id]);
+	conversation_names[conversation_id].clear();
+	live_message_count -= std::min(live_message_count, indexed_message_counts[conversation_id]);
+	indexed_message_counts[conversation_id] = 0;
+
+	// Only the words the conversation used have postings to drop.
+	for (auto&& word : conversation_words[conversation_id]) {
+		auto word_postings = postings.find(word);
+
+		if (word_postings == postings.end())
+			continue;
+
+		std::vector<Posting>& removed_from = word_postings->second;
+		removed_from.erase(std::remove_if(removed_from.begin(), removed_from.end(), [conversation_id](const Posting& posting) { return posting.conversation_id == conversation_id; }),
+			removed_from.end());
+
+		if (removed_from.empty())
+			postings.erase(word_postings);
+	}
+
+	conversation_words[conversation_id].clear();
+}
+
+void SearchIndex::add_message(uint32_t conversation_id, uint32_t message_index, uint64_t sent_at, const std::vector<QString>& words) {
+	for (auto&& word : words) {
+		postings[word].push_back(Posting{ conversation_id, message_index, sent_at });
+		conversation_words[conversation_id].insert(word);
+	}
+
+	indexed_message_counts[conversation_id] = std::max<size_t>(indexed_message_counts[conversation_id], message_index + 1);
+	live_message_count++;
+}
+
+size_t SearchIndex::indexed_message_count(const QString& friend_username) const {
+	auto it = conversation_ids.find(friend_username);
+	return it != conversation_ids.end() ? indexed_message_counts[it->second] : 0;
+}
+
+uint32_t SearchIndex::journaled_conversation_id(const QString& friend_username) {
+	auto existing = conversation_ids.find(friend_username);
+
+	if (existing != conversation_ids.end())
+		return existing->second;
+
+	uint32_t conversation_id = add_conversation(friend_username);
+	journal_stream << static_cast<quint8>(CONVERSATION_ADDED) << friend_username;
+
+	return conversation_id;
+}
+
+void SearchIndex::index_message(uint32_t conversation_id, uint32_t message_index, const StoredMessage& message) {
+	// Every word counts once per message, so a word repeated in one message doesn't push it up the results.
+	std::vector<QString> words = tokenize(QString::fromUtf8(message.content.data(), static_cast<int>(message.content.size())));
+	std::sort(words.begin(), words.end());
+	words.erase(std::unique(words.begin(), words.end()), words.end());
+
+	add_message(conversation_id, message_index, message.sent_at, words);
+
+	journal_stream << static_cast<quint8>(MESSAGE_ADDED) << static_cast<quint32>(conversation_id) << static_cast<quint32>(message_index)
+		<< static_cast<quint64>(message.sent_at) << static_cast<quint32>(words.size());
+
+	for (auto&& word : words) {
+		journal_stream << word;
+	}
+
+	journal_message_count++;
+}
+
+void SearchIndex::add(const QString& friend_username, size_t message_index, const StoredMessage& message) {
+	if (!journal.isOpen())
+		return; // Without the journal the next login couldn't tell what is indexed, so nothing is, and it catches up from the logs instead.
+
+	index_message(journaled_conversation_id(friend_username), static_cast<uint32_t>(message_index), message);
+}
+
+void SearchIndex::add(const QString& friend_username, size_t first_message_index, const std::vector<StoredMessage>& oldest_first_messages) {
+	if (!journal.isOpen() || oldest_first_messages.empty())
+		return;
+
+	uint32_t conversation_id = journaled_conversation_id(friend_username);
+
+	for (size_t i = 0; i < oldest_first_messages.size(); i++) {
+		index_message(conversation_id, static_cast<uint32_t>(first_message_index + i), oldest_first_messages[i]);
+	}
+}
+
+void SearchIndex::remove(const QString& friend_username) {
+	auto existing = conversation_ids.find(friend_username);
+
+	if (existing == conversation_ids.end())
+		return;
+
+	uint32_t conversation_id = existing->second;
+	remove_conversation(conversation_id);
+
+	if (journal.isOpen()) {
+		journal_stream << static_cast<quint8>(CONVERSATION_REMOVED) << static_cast<quint32>(conversation_id);
+		flush_journal();
+		compact_journal_if_needed();
+	}
+}
+
+void SearchIndex::flush() {
+	if (journal.isOpen())
+		flush_journal();
+}
+
+void SearchIndex::flush_journal() {
+	if (journal.flush() && journal_stream.status() == QDataStream::Ok)
+		return;
+
+	std::cerr << "Can't write to the search index " << journal.fileName().toStdString() << ": " << journal.errorString().toStdString() << "\n";
+
+	// Replaying drops a partial record at the end, and the messages after it are indexed again from the logs.
+	journal_stream.setDevice(nullptr);
+	journal.close();
+}
+
+void SearchIndex::compact_journal_if_needed() {
+	size_t removed_message_count = journal_message_count - std::min(journal_message_count, live_message_count);
+
+	if (journal.isOpen() && removed_message_count > std::max(live_message_count, min_compacted_message_count))
+		compact_journal();
+}
+
+void SearchIndex::compact_journal() {
+	QString journal_path = journal.fileName();
+	QSaveFile compacted_journal(journal_path); // Replaces the journal only once the whole new one is written.
+
+	if (!compacted_journal.open(QIODevice::WriteOnly)) {
+		std::cerr << "Can't compact the search index " << journal_path.toStdString() << ": " << compacted_journal.errorString().toStdString() << "\n";
+		return;
+	}
+
+	QDataStream compacted_stream(&compacted_journal);
+	compacted_stream.setVersion(QDataStream::Qt_5_0);
+	quint32 compacted_conversation_id = 0;
+
+	for (uint32_t conversation_id = 0; conversation_id < conversation_names.size(); conversation_id++) {
+		if (conversation_names[conversation_id].isEmpty())
+			continue;
+
+		// Postings are kept per word, so the words of every message are gathered back first. Messages without words keep the count right.
+		size_t message_count = indexed_message_counts[conversation_id];
+		std::vector<std::vector<QString>> message_words(message_count);
+		std::vector<uint64_t> message_sent_at(message_count, 0);
+
+		for (auto&& word : conversation_words[conversation_id]) {
+			for (auto&& posting : postings.at(word)) {
+				if (posting.conversation_id != conversation_id)
+					continue;
+
+				message_words[posting.message_index].push_back(word);
+				message_sent_at[posting.message_index] = posting.sent_at;
+			}
+		}
+
+		compacted_stream << static_cast<quint8>(CONVERSATION_ADDED) << conversation_names[conversation_id];
+
+		for (size_t i = 0; i < message_count; i++) {
+			std::vector<QString>& words = message_words[i];
+			std::sort(words.begin(), words.end());
+
+			compacted_stream << static_cast<quint8>(MESSAGE_ADDED) << compacted_conversation_id << static_cast<quint32>(i)
+				<< static_cast<quint64>(message_sent_at[i]) << static_cast<quint32>(words.size());
+
+			for (auto&& word : words) {
+				compacted_stream << word;
+			}
+		}
+
+		compacted_conversation_id++;
+	}
+
+	if (compacted_stream.status() != QDataStream::Ok) {
+		std::cerr << "Can't compact the search index " << journal_path.toStdString() << ": " << compacted_journal.errorString().toStdString() << "\n";
+		compacted_journal.cancelWriting();
+		return;
+	}
+
+	// The journal is closed first, some platforms can't replace a file that is still open.
+	journal_stream.setDevice(nullptr);
+	journal.close();
+
+	if (!compacted_journal.commit())
+		std::cerr << "Can't compact the search index " << journal_path.toStdString() << ": " << compacted_journal.errorString().toStdString() << "\n";
+
+	open(journal_path); // Conversation ids are renumbered in the compacted journal, replaying it is the simplest way to match them.
+}
+
+std::vector<SearchHit> SearchIndex::search(const QString& query, size_t max_hit_count) const {
+	std::vector<QString> words = tokenize(query);
+	std::sort(words.begin(), words.end());
+	words.erase(std::unique(words.begin(), words.end()), words.end());
+
+	// Score every message that has at least one of the words by how many of them it has.
+	std::unordered_map<uint64_t, SearchHit> hits;
+
+	for (auto&& word : words) {
+		auto word_postings = postings.find(word);
+
+		if (word_postings == postings.end())
+			continue;
+
+		for (auto&& posting : word_postings->second) {
+			uint64_t key = (static_cast<uint64_t>(posting.conversation_id) << 32) | posting.message_index;
+			auto [hit, is_new] = hits.try_emplace(key, SearchHit{ QString(), posting.message_index, posting.sent_at, 0 });
+
+			if (is_new)
+				hit->second.friend_username = conversation_names[posting.conversation_id];
+
+			hit->second.score++;
+		}
+	}
+
+	std::vector<SearchHit> ranked_hits;
+	ranked_hits.reserve(hits.size());
+
+	for (auto&& [key, hit] : hits) {
+		ranked_hits.push_back(std::move(hit));
+	}
+
+	auto is_better = [](const SearchHit& a, const SearchHit& b) { return a.score != b.score ? a.score > b.score : a.sent_at > b.sent_at; };
+	size_t kept_hit_count = std::min(max_hit_count, ranked_hits.size());
+
+	std::partial_sort(ranked_hits.begin(), ranked_hits.begin() + kept_hit_count, ranked_hits.end(), is_better);
+	ranked_hits.resize(kept_hit_count);
+
+	return ranked_hits;
+}
+
+std::vector<QString> SearchIndex::tokenize(const QString& text) {
+	std::vector<QString> words;
+	QString word;
+
+	for (QChar character : text) {
+		if (character.isLetterOrNumber()) {
+			word.append(character.toLower());
+		}
+		else if (!word.isEmpty()) {
+			words.push_back(word);
+			word.clear();
+		}
+	}
+
+	if (!word.isEmpty())
+		words.push_back(word);
+
+	return words;
+}
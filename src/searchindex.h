@@ -0,0 +1,74 @@
+#pragma once
+
+#include <QString>
+#include <QFile>
+#include <QDataStream>
+#include <QSaveFile>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
+#include "conversationstore.h"
+
+struct SearchHit {
+	QString friend_username;
+	size_t message_index; // Position of the message in the friend's MessageCache log.
+	unsigned long long sent_at;
+	int score; // How many of the query's words the message has.
+};
+
+/* Inverted index from words to the cached messages that contain them, kept up to date as messages are cached. Changes are appended to a
+journal next to the cache and replayed when the account logs in again, so nothing has to be re-read from the logs. Once most of the journal
+is about removed conversations, it is rewritten from what is left. */
+class SearchIndex {
+	private:
+		struct Posting {
+			uint32_t conversation_id;
+			uint32_t message_index;
+			uint64_t sent_at;
+		};
+
+		enum JournalRecord : quint8 {
+			CONVERSATION_ADDED = 'C',
+			CONVERSATION_REMOVED = 'R',
+			MESSAGE_ADDED = 'M'
+		};
+
+		std::vector<QString> conversation_names; // By id. A replaced or removed conversation keeps its id with an empty name.
+		std::vector<size_t> indexed_message_counts; // By id.
+		std::unordered_map<QString, uint32_t, QStringHasher> conversation_ids;
+		std::unordered_map<QString, std::vector<Posting>, QStringHasher> postings; // Per word, in the order the messages were indexed.
+		std::vector<std::unordered_set<QString, QStringHasher>> conversation_words; // By id, the words that have postings of the conversation.
+
+		QFile journal;
+		QDataStream journal_stream;
+		size_t journal_message_count = 0; // Message records in the journal, including the ones of removed conversations.
+		size_t live_message_count = 0;
+
+		static constexpr size_t min_compacted_message_count = 10000; // Smaller journals replay quickly enough either way.
+
+		uint32_t add_conversation(const QString& friend_username);
+		void remove_conversation(uint32_t conversation_id);
+		void add_message(uint32_t conversation_id, uint32_t message_index, uint64_t sent_at, const std::vector<QString>& words);
+		uint32_t journaled_conversation_id(const QString& friend_username); // Adds the conversation first if it's new.
+		void index_message(uint32_t conversation_id, uint32_t message_index, const StoredMessage& message);
+		void replay_journal();
+		void flush_journal(); // Stops journaling for the rest of the session if a write failed, the next login catches up from the message logs.
+		void compact_journal_if_needed();
+		void compact_journal();
+
+	public:
+		void open(const QString& journal_path);
+		void close();
+
+		size_t indexed_message_count(const QString& friend_username) const;
+		// The journal records of added messages are buffered until flush().
+		void add(const QString& friend_username, size_t message_index, const StoredMessage& message);
+		void add(const QString& friend_username, size_t first_message_index, const std::vector<StoredMessage>& oldest_first_messages);
+		void remove(const QString& friend_username);
+		void flush();
+
+		std::vector<SearchHit> search(const QString& query, size_t max_hit_count) const; // Best hits first, newer messages first among equals.
+
+		static std::vector<QString> tokenize(const QString& text); // Lowercased words, anything that isn't a letter or a digit separates them.
+};
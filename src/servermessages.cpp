@@ -0,0 +1,291 @@
+#include "servermessages.h"
+
+namespace {
+	using json = nlohmann::json;
+
+	// Value of a top-level field. Nested values are only kept in the two shapes the server uses: string arrays and objects of booleans.
+	using FieldValue = std::variant<std::monostate, bool, unsigned long long, std::string, std::vector<std::string>, std::vector<std::pair<std::string, bool>>>;
+
+	template <typename T>
+	void take(FieldValue& value, T& target) {
+		if (T* field = std::get_if<T>(&value))
+			target = std::move(*field);
+	}
+
+	void assign_field(ErrorMessage& message, std::string_view key, FieldValue& value) {
+		if (key == "received-type") take(value, message.received_type);
+	}
+
+	void assign_field(LoginAuthentication& message, std::string_view key, FieldValue& value) {
+		if (key == "success") take(value, message.success);
+		else if (key == "cookie") take(value, message.cookie);
+		else if (key == "friends") take(value, message.friends);
+		else if (key == "friend-requests") take(value, message.friend_requests);
+		else if (key == "failure-reason") take(value, message.failure_reason);
+	}
+
+	void assign_field(RegistrationConfirmation& message, std::string_view key, FieldValue& value) {
+		if (key == "success") take(value, message.success);
+		else if (key == "failure-reason") take(value, message.failure_reason);
+	}
+
+	void assign_field(FriendRequestResult& message, std::string_view key, FieldValue& value) {
+		if (key == "success") take(value, message.success);
+		else if (key == "reason") take(value, message.reason);
+	}
+
+	void assign_field(SendMessageResult& message, std::string_view key, FieldValue& value) {
+		if (key == "success") take(value, message.success);
+		else if (key == "reason") take(value, message.reason);
+	}
+
+	void assign_field(NewMessage& message, std::string_view key, FieldValue& value) {
+		if (key == "sent-at") take(value, message.sent_at);
+		else if (key == "sent-by") take(value, message.sent_by);
+		else if (key == "message-content") take(value, message.message_content);
+	}
+
+	void assign_field(NewFriendshipRequest& message, std::string_view key, FieldValue& value) {
+		if (key == "sent-by") take(value, message.sent_by);
+	}
+
+	void assign_field(FriendshipRequestUpdate& message, std::string_view key, FieldValue& value) {
+		if (key == "request-recipient") take(value, message.request_recipient);
+		else if (key == "is_accepted") take(value, message.is_accepted);
+	}
+
+	void assign_field(FriendDeletionUpdate& message, std::string_view key, FieldValue& value) {
+		if (key == "deleted-user") take(value, message.deleted_user);
+		else if (key == "success") take(value, message.success);
+		else if (key == "reason") take(value, message.reason);
+	}
+
+	void assign_field(DeletedByFriend& message, std::string_view key, FieldValue& value) {
+		if (key == "deleted-by") take(value, message.deleted_by);
+	}
+
+	void assign_field(ForcedLogout& message, std::string_view key, FieldValue& value) {
+		if (key == "reason") take(value, message.reason);
+	}
+
+	void assign_field(FetchMessagesResponse& message, std::string_view key, FieldValue& value) {
+		if (key == "success") take(value, message.success);
+		else if (key == "user") take(value, message.user);
+		else if (key == "reason") take(value, message.reason);
+		else if (key == "messages") take(value, message.messages);
+	}
+
+	void assign_field(DummyMessage&, std::string_view, FieldValue&) {
+	}
+
+	void assign_field(StatusResponse& message, std::string_view key, FieldValue& value) {
+		if (key == "friend-username") take(value, message.friend_username);
+		else if (key == "is_online") take(value, message.is_online);
+	}
+
+	void assign_field(StatusesResponse& message, std::string_view key, FieldValue& value) {
+		if (key == "is_friend_online") take(value, message.is_friend_online);
+	}
+
+	void assign_field(HistoryEntry& entry, std::string_view key, FieldValue& value) {
+		if (key == "sent-at") take(value, entry.sent_at);
+		else if (key == "sent-by") take(value, entry.sent_by);
+		else if (key == "message-content") take(value, entry.message_content);
+	}
+
+	template <size_t... indices>
+	ServerMessage make_message(ReceivedMessageType type, std::index_sequence<indices...>) {
+		static constexpr ServerMessage (*factories[])() = { [] { return ServerMessage(std::in_place_index<indices>); }... };
+		return factories[static_cast<size_t>(type)]();
+	}
+
+	// Receives the top-level fields of a ServerMessage frame. The struct is picked as soon as "message-type" shows up.
+	class ServerMessageSink {
+		private:
+			ServerMessage& message;
+			std::string& error;
+			bool has_type = false;
+			std::vector<std::pair<std::string, FieldValue>> early_fields; // Fields that came before "message-type", the server normally sends it first.
+
+		public:
+			ServerMessageSink(ServerMessage& message, std::string& error) : message(message), error(error) {}
+
+			bool on_field(const std::string& key, FieldValue& value) {
+				if (key == "message-type") {
+					std::string* type_string = std::get_if<std::string>(&value);
+					std::optional<ReceivedMessageType> type = type_string != nullptr ? message_type_from_string(*type_string) : std::nullopt;
+
+					if (!type) {
+						error = "unknown message-type " + (type_string != nullptr ? *type_string : std::string("(not a string)"));
+						return false;
+					}
+
+					message = make_message(*type, std::make_index_sequence<std::variant_size_v<ServerMessage>>());
+					has_type = true;
+
+					for (auto&& [early_key, early_value] : early_fields) {
+						std::visit([&](auto& typed_message) { assign_field(typed_message, early_key, early_value); }, message);
+					}
+
+					early_fields.clear();
+					return true;
+				}
+
+				if (has_type)
+					std::visit([&](auto& typed_message) { assign_field(typed_message, key, value); }, message);
+				else
+					early_fields.emplace_back(key, std::move(value));
+
+				return true;
+			}
+
+			bool finish() {
+				if (!has_type)
+					error = "missing message-type";
+
+				return has_type;
+			}
+	};
+
+	class HistoryEntrySink {
+		private:
+			HistoryEntry& entry;
+
+		public:
+			HistoryEntrySink(HistoryEntry& entry) : entry(entry) {}
+
+			bool on_field(const std::string& key, FieldValue& value) {
+				assign_field(entry, key, value);
+				return true;
+			}
+
+			bool finish() {
+				return true;
+			}
+	};
+
+	// SAX handler for a flat JSON object. Every top-level value is handed to the sink as soon as it is complete, nothing else is kept.
+	template <typename Sink>
+	class FlatObjectSaxHandler : public nlohmann::json_sax<json> {
+		private:
+			Sink& sink;
+			std::string& error;
+			int depth = 0;
+			std::string current_key;
+			std::string nested_key;
+			FieldValue nested_value;
+
+			bool on_scalar(FieldValue value) {
+				if (depth == 1) // Top-level field.
+					return sink.on_field(current_key, value);
+
+				if (depth == 2) { // Element of a top-level array or object.
+					if (auto* strings = std::get_if<std::vector<std::string>>(&nested_value)) {
+						if (auto* string = std::get_if<std::string>(&value))
+							strings->emplace_back(std::move(*string));
+					}
+					else if (auto* flags = std::get_if<std::vector<std::pair<std::string, bool>>>(&nested_value)) {
+						if (auto* flag = std::get_if<bool>(&value))
+							flags->emplace_back(std::move(nested_key), *flag);
+					}
+				}
+
+				return true; // Anything nested deeper than that isn't used by any message.
+			}
+
+		public:
+			FlatObjectSaxHandler(Sink& sink, std::string& error) : sink(sink), error(error) {}
+
+			bool null() override { return on_scalar(std::monostate()); }
+			bool boolean(bool value) override { return on_scalar(value); }
+			bool number_integer(number_integer_t value) override { return on_scalar(value >= 0 ? FieldValue(static_cast<unsigned long long>(value)) : FieldValue()); }
+			bool number_unsigned(number_unsigned_t value) override { return on_scalar(static_cast<unsigned long long>(value)); }
+			bool number_float(number_float_t, const string_t&) override { return on_scalar(std::monostate()); }
+			bool string(string_t& value) override { return on_scalar(std::move(value)); }
+			bool binary(binary_t&) override { return on_scalar(std::monostate()); }
+
+			bool start_object(std::size_t) override {
+				depth++;
+
+				if (depth == 2)
+					nested_value = std::vector<std::pair<std::string, bool>>();
+
+				return true;
+			}
+
+			bool end_object() override {
+				if (depth == 2 && !sink.on_field(current_key, nested_value))
+					return false;
+
+				depth--;
+				return true;
+			}
+
+			bool start_array(std::size_t) override {
+				if (depth == 0) {
+					error = "top-level value is not an object";
+					return false;
+				}
+
+				depth++;
+
+				if (depth == 2)
+					nested_value = std::vector<std::string>();
+
+				return true;
+			}
+
+			bool end_array() override {
+				if (depth == 2 && !sink.on_field(current_key, nested_value))
+					return false;
+
+				depth--;
+				return true;
+			}
+
+			bool key(string_t& value) override {
+				if (depth == 1)
+					current_key = std::move(value);
+				else if (depth == 2)
+					nested_key = std::move(value);
+
+				return true;
+			}
+
+			bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& e) override {
+				error = e.what();
+				return false;
+			}
+
+			bool finish() {
+				if (depth != 0 && error.empty())
+					error = "top-level value is not an object";
+
+				return error.empty() && sink.finish();
+			}
+	};
+
+	template <typename Sink>
+	bool decode_flat_object(std::string_view text, Sink& sink, std::string& error) {
+		FlatObjectSaxHandler<Sink> handler(sink, error);
+
+		if (!json::sax_parse(text.data(), text.data() + text.size(), &handler)) {
+			if (error.empty())
+				error = "malformed JSON";
+
+			return false;
+		}
+
+		return handler.finish();
+	}
+}
+
+bool decode_server_message(std::string_view frame, ServerMessage& message, std::string& error) {
+	ServerMessageSink sink(message, error);
+	return decode_flat_object(frame, sink, error);
+}
+
+bool decode_history_entry(std::string_view entry, HistoryEntry& history_entry, std::string& error) {
+	HistoryEntrySink sink(history_entry);
+	return decode_flat_object(entry, sink, error);
+}
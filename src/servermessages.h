@@ -0,0 +1,306 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <variant>
+#include <array>
+#include <optional>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+
+enum class ReceivedMessageType {
+	ERROR_MESSAGE,
+	LOGIN_AUTHENTICATION,
+	REGISTRATION_CONFIRMATION,
+	FRIEND_REQUEST_RESULT,
+	SEND_MESSAGE_RESULT,
+	NEW_MESSAGE,
+	NEW_FRIENDSHIP_REQUEST,
+	FRIENDSHIP_REQUEST_UPDATE,
+	FRIEND_DELETION_UPDATE,
+	DELETED_BY_FRIEND,
+	FORCED_LOGOUT,
+	FETCH_MESSAGES_REQUEST_RESPONSE,
+	DUMMY_MESSAGE,
+	GET_STATUS_RESPONSE,
+	GET_STATUSES_RESPONSE
+};
+
+struct MessageTypeName {
+	std::string_view name;
+	ReceivedMessageType type;
+};
+
+// The "message-type" string of every message the server sends.
+inline constexpr std::array<MessageTypeName, 15> message_type_names {{
+	{"unexpected-error", ReceivedMessageType::ERROR_MESSAGE},
+	{"login-authentication", ReceivedMessageType::LOGIN_AUTHENTICATION},
+	{"registration-confirmation", ReceivedMessageType::REGISTRATION_CONFIRMATION},
+	{"friend-request-result", ReceivedMessageType::FRIEND_REQUEST_RESULT},
+	{"send-message-result", ReceivedMessageType::SEND_MESSAGE_RESULT},
+	{"new-message", ReceivedMessageType::NEW_MESSAGE},
+	{"new-friendship-request", ReceivedMessageType::NEW_FRIENDSHIP_REQUEST},
+	{"friend-request-update", ReceivedMessageType::FRIENDSHIP_REQUEST_UPDATE},
+	{"friend-deletion-update", ReceivedMessageType::FRIEND_DELETION_UPDATE},
+	{"deleted-by-friend", ReceivedMessageType::DELETED_BY_FRIEND},
+	{"forced-logout", ReceivedMessageType::FORCED_LOGOUT},
+	{"fetch-messages-request-response", ReceivedMessageType::FETCH_MESSAGES_REQUEST_RESPONSE},
+	{"dummy-message", ReceivedMessageType::DUMMY_MESSAGE},
+	{"get-status-response", ReceivedMessageType::GET_STATUS_RESPONSE},
+	{"get-statuses-response", ReceivedMessageType::GET_STATUSES_RESPONSE}
+}};
+
+/* Perfect hash from "message-type" strings to ReceivedMessageType, generated at compile time: the smallest power-of-two table in which
+the FNV-1a hashes of the names above don't collide. A lookup is one hash, one table read and one string compare. */
+namespace message_type_hash {
+	constexpr uint32_t fnv1a(std::string_view string) {
+		uint32_t hash = 2166136261u;
+
+		for (char c : string) {
+			hash ^= static_cast<uint8_t>(c);
+			hash *= 16777619u;
+		}
+
+		return hash;
+	}
+
+	constexpr bool is_collision_free(size_t table_size) {
+		std::array<bool, 1024> is_taken {};
+
+		for (auto&& entry : message_type_names) {
+			size_t slot = fnv1a(entry.name) & (table_size - 1);
+
+			if (is_taken[slot])
+				return false;
+
+			is_taken[slot] = true;
+		}
+
+		return true;
+	}
+
+	constexpr size_t find_table_size() {
+		for (size_t table_size = 16; table_size <= 1024; table_size *= 2) {
+			if (is_collision_free(table_size))
+				return table_size;
+		}
+
+		return 0;
+	}
+
+	inline constexpr size_t table_size = find_table_size();
+	static_assert(table_size != 0, "No collision-free table size for message_type_names, change the hash function.");
+
+	constexpr std::array<int8_t, table_size> make_table() {
+		std::array<int8_t, table_size> table {};
+
+		for (auto&& slot : table) {
+			slot = -1;
+		}
+
+		for (size_t i = 0; i < message_type_names.size(); i++) {
+			table[fnv1a(message_type_names[i].name) & (table_size - 1)] = static_cast<int8_t>(i);
+		}
+
+		return table;
+	}
+
+	inline constexpr std::array<int8_t, table_size> table = make_table();
+}
+
+// Returns std::nullopt for message types we don't know about, they are never mistaken for another type.
+constexpr std::optional<ReceivedMessageType> message_type_from_string(std::string_view type_string) {
+	int8_t index = message_type_hash::table[message_type_hash::fnv1a(type_string) & (message_type_hash::table_size - 1)];
+
+	if (index < 0 || message_type_names[index].name != type_string)
+		return std::nullopt;
+
+	return message_type_names[index].type;
+}
+
+static_assert(message_type_from_string("new-message") == ReceivedMessageType::NEW_MESSAGE);
+static_assert(!message_type_from_string("new-messages").has_value());
+
+// One struct per message type the server sends. Fields the server leaves out keep their default values.
+
+struct ErrorMessage {
+	std::string received_type;
+};
+
+struct LoginAuthentication {
+	bool success = false;
+	std::string cookie;
+	std::vector<std::string> friends;
+	std::vector<std::string> friend_requests;
+	std::string failure_reason;
+};
+
+struct RegistrationConfirmation {
+	bool success = false;
+	std::string failure_reason;
+};
+
+struct FriendRequestResult {
+	bool success = false;
+	std::string reason;
+};
+
+struct SendMessageResult {
+	bool success = false;
+	std::string reason;
+};
+
+struct NewMessage {
+	unsigned long long sent_at = 0;
+	std::string sent_by;
+	std::string message_content;
+};
+
+struct NewFriendshipRequest {
+	std::string sent_by;
+};
+
+struct FriendshipRequestUpdate {
+	std::string request_recipient;
+	bool is_accepted = false;
+};
+
+struct FriendDeletionUpdate {
+	std::string deleted_user;
+	bool success = false;
+	std::string reason;
+};
+
+struct DeletedByFriend {
+	std::string deleted_by;
+};
+
+struct ForcedLogout {
+	std::string reason;
+};
+
+struct FetchMessagesResponse {
+	bool success = false;
+	std::string user;
+	std::string reason;
+	std::vector<std::string> messages; // Newest first, every entry is a JSON-encoded HistoryEntry.
+};
+
+struct DummyMessage {
+};
+
+struct StatusResponse {
+	std::string friend_username;
+	bool is_online = false;
+};
+
+struct StatusesResponse {
+	std::vector<std::pair<std::string, bool>> is_friend_online;
+};
+
+// An entry of FetchMessagesResponse::messages.
+struct HistoryEntry {
+	unsigned long long sent_at = 0;
+	std::string sent_by;
+	std::string message_content;
+};
+
+// The alternatives are in the same order as ReceivedMessageType, so message.index() is the message's type.
+using ServerMessage = std::variant<
+	ErrorMessage,
+	LoginAuthentication,
+	RegistrationConfirmation,
+	FriendRequestResult,
+	SendMessageResult,
+	NewMessage,
+	NewFriendshipRequest,
+	FriendshipRequestUpdate,
+	FriendDeletionUpdate,
+	DeletedByFriend,
+	ForcedLogout,
+	FetchMessagesResponse,
+	DummyMessage,
+	StatusResponse,
+	StatusesResponse
+>;
+
+static_assert(std::variant_size_v<ServerMessage> == static_cast<size_t>(ReceivedMessageType::GET_STATUSES_RESPONSE) + 1,
+	"ServerMessage needs exactly one alternative per ReceivedMessageType.");
+
+inline ReceivedMessageType get_message_type(const ServerMessage& message) {
+	return static_cast<ReceivedMessageType>(message.index());
+}
+
+/* Compile-time table from message type to handler. Every handler is a member function of Owner taking the struct of the message type it
+handles, e.g. MessageHandlerTable<&MainWidget::new_message_received, ...>, where new_message_received takes a NewMessage&. The table is
+indexed by ServerMessage::index(), so dispatching is a single indirect call. */
+template <typename Handler>
+struct message_handler_traits;
+
+template <typename Owner, typename Message>
+struct message_handler_traits<void (Owner::*)(Message&)> {
+	using owner_type = Owner;
+	using message_type = Message;
+};
+
+template <typename Message, typename... Alternatives>
+constexpr size_t alternative_index(const std::variant<Alternatives...>*) {
+	constexpr bool matches[] = { std::is_same_v<Message, Alternatives>... };
+
+	for (size_t i = 0; i < sizeof...(Alternatives); i++) {
+		if (matches[i])
+			return i;
+	}
+
+	return sizeof...(Alternatives);
+}
+
+template <auto first_handler, auto... handlers>
+class MessageHandlerTable {
+	private:
+		using Owner = typename message_handler_traits<decltype(first_handler)>::owner_type;
+		using Thunk = void (*)(Owner& owner, ServerMessage& message);
+
+		template <auto handler>
+		static void invoke(Owner& owner, ServerMessage& message) {
+			using Message = typename message_handler_traits<decltype(handler)>::message_type;
+			(owner.*handler)(std::get<Message>(message));
+		}
+
+		template <auto handler>
+		static constexpr size_t index_of() {
+			using Message = typename message_handler_traits<decltype(handler)>::message_type;
+			constexpr size_t index = alternative_index<Message>(static_cast<const ServerMessage*>(nullptr));
+			static_assert(index < std::variant_size_v<ServerMessage>, "Handler takes a type that isn't a ServerMessage alternative.");
+			return index;
+		}
+
+		static constexpr std::array<Thunk, std::variant_size_v<ServerMessage>> make_table() {
+			std::array<Thunk, std::variant_size_v<ServerMessage>> table {};
+
+			table[index_of<first_handler>()] = &invoke<first_handler>;
+			((table[index_of<handlers>()] = &invoke<handlers>), ...);
+
+			return table;
+		}
+
+		static constexpr std::array<Thunk, std::variant_size_v<ServerMessage>> table = make_table();
+
+	public:
+		static bool dispatch(Owner& owner, ServerMessage& message) { // Returns false if no handler is registered for the message's type.
+			Thunk thunk = table[message.index()];
+
+			if (thunk == nullptr)
+				return false;
+
+			thunk(owner, message);
+			return true;
+		}
+};
+
+/* Decoders that fill the structs straight from the JSON text through nlohmann's SAX interface, without building a json DOM.
+They return false and describe the problem in error if the frame is malformed or has an unknown message-type. */
+bool decode_server_message(std::string_view frame, ServerMessage& message, std::string& error);
+bool decode_history_entry(std::string_view entry, HistoryEntry& history_entry, std::string& error);
@@ -0,0 +1,48 @@
+#include "usernametable.h"
+
+UsernameTable& UsernameTable::instance() {
+	static UsernameTable table;
+	return table;
+}
+
+uint32_t UsernameTable::add(const QString& username, std::string utf8_username) {
+	uint32_t id = static_cast<uint32_t>(names.size());
+
+	names.push_back(Name{ username, utf8_username });
+	ids.insert(username, id);
+	utf8_ids.emplace(std::move(utf8_username), id);
+
+	return id;
+}
+
+uint32_t UsernameTable::intern(const QString& username) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = ids.constFind(username);
+
+	if (it != ids.constEnd())
+		return it.value();
+
+	return add(username, username.toStdString());
+}
+
+uint32_t UsernameTable::intern_utf8(std::string_view utf8_username) {
+	std::string key(utf8_username); // Most usernames fit in the small string buffer, so this rarely allocates.
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = utf8_ids.find(key);
+
+	if (it != utf8_ids.end())
+		return it->second;
+
+	return add(QString::fromStdString(key), std::move(key));
+}
+
+QString UsernameTable::name(uint32_t id) const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return id < names.size() ? names[id].name : QString();
+}
+
+const std::string& UsernameTable::utf8_name(uint32_t id) const {
+	static const std::string unknown_name;
+	std::lock_guard<std::mutex> lock(mutex);
+	return id < names.size() ? names[id].utf8_name : unknown_name;
+}
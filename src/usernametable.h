@@ -0,0 +1,38 @@
+#pragma once
+
+#include <QString>
+#include <QHash>
+#include <string>
+#include <string_view>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+
+/* Every username seen during this run, stored once. Messages keep the small id instead of their own copy of the sender's name, and the
+name is only looked up when a message is shown or written to the cache. Ids are never reused, and the table can be used from any thread. */
+class UsernameTable {
+	private:
+		mutable std::mutex mutex;
+		QHash<QString, uint32_t> ids;
+		std::unordered_map<std::string, uint32_t> utf8_ids; // Names as the server sends them, so incoming messages skip the QString conversion.
+		struct Name {
+			QString name;
+			std::string utf8_name;
+		};
+
+		std::deque<Name> names; // By id. A deque never moves its elements when growing, so references handed out stay valid.
+
+		uint32_t add(const QString& username, std::string utf8_username); // mutex must be held.
+
+		UsernameTable() = default;
+
+	public:
+		static UsernameTable& instance();
+
+		uint32_t intern(const QString& username);
+		uint32_t intern_utf8(std::string_view utf8_username);
+
+		QString name(uint32_t id) const;
+		const std::string& utf8_name(uint32_t id) const; // The reference stays valid for the rest of the run.
+};